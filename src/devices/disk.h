@@ -2,6 +2,7 @@
 #define DEVICES_DISK_H
 
 #include <inttypes.h>
+#include <stddef.h>
 #include <stdint.h>
 
 /* Size of a disk sector in bytes. */
@@ -11,6 +12,9 @@
    Good enough for disks up to 2 TB. */
 typedef uint32_t disk_sector_t;
 
+/* Maximum number of sectors moved by one multi-sector transfer. */
+#define DISK_MULTIPLE_MAX 256
+
 /* Format specifier for printf(), e.g.:
    printf ("sector=%"PRDSNu"\n", sector); */
 #define PRDSNu PRIu32
@@ -22,5 +26,9 @@ struct disk *disk_get (int chan_no, int dev_no);
 disk_sector_t disk_size (struct disk *);
 void disk_read (struct disk *, disk_sector_t, void *);
 void disk_write (struct disk *, disk_sector_t, const void *);
+void disk_read_multiple (struct disk *, disk_sector_t, size_t cnt,
+                         void *const buffers[]);
+void disk_write_multiple (struct disk *, disk_sector_t, size_t cnt,
+                          const void *const buffers[]);
 
 #endif /* devices/disk.h */
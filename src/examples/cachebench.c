@@ -0,0 +1,157 @@
+/* cachebench.c
+
+   Measures how well the buffer cache keeps a small, frequently
+   used set of files while a large file is streamed through it.
+   Run it once per replacement policy and compare, e.g.:
+
+     pintos -- -f -q -cache-policy=clock run cachebench
+     pintos -- -f -q -cache-policy=2q run cachebench */
+
+#include <stdio.h>
+#include <string.h>
+#include <syscall.h>
+
+/* Hot set: small files opened over and over, standing in for
+   the inode, index and directory sectors of a busy tree. */
+#define HOT_CNT 16
+#define HOT_SIZE 512
+
+/* Streamed file, several times the default cache size. */
+#define STREAM_SIZE (256 * 1024)
+
+#define ROUNDS 4
+
+static char buf[4096];
+
+static void
+make_file (const char *name, int size)
+{
+  int fd;
+
+  if (!create (name, 0))
+    {
+      printf ("cachebench: create %s failed\n", name);
+      exit (EXIT_FAILURE);
+    }
+  fd = open (name);
+  if (fd < 0)
+    {
+      printf ("cachebench: open %s failed\n", name);
+      exit (EXIT_FAILURE);
+    }
+  memset (buf, 'x', sizeof buf);
+  while (size > 0)
+    {
+      int chunk = size < (int) sizeof buf ? size : (int) sizeof buf;
+      if (write (fd, buf, chunk) != chunk)
+        {
+          printf ("cachebench: write %s failed\n", name);
+          exit (EXIT_FAILURE);
+        }
+      size -= chunk;
+    }
+  close (fd);
+}
+
+static void
+read_file (const char *name)
+{
+  int fd = open (name);
+
+  if (fd < 0)
+    {
+      printf ("cachebench: open %s failed\n", name);
+      exit (EXIT_FAILURE);
+    }
+  while (read (fd, buf, sizeof buf) > 0)
+    continue;
+  close (fd);
+}
+
+static void
+hot_name (char name[], int i)
+{
+  snprintf (name, 16, "hot%d", i);
+}
+
+static void
+read_hot_set (void)
+{
+  char name[16];
+  int i;
+
+  for (i = 0; i < HOT_CNT; i++)
+    {
+      hot_name (name, i);
+      read_file (name);
+    }
+}
+
+static void
+get_stats (struct cache_stats *s)
+{
+  if (!cachestat (s))
+    {
+      printf ("cachebench: cachestat failed\n");
+      exit (EXIT_FAILURE);
+    }
+}
+
+/* Prints the hits and misses between *BEFORE and *AFTER. */
+static void
+report (const char *phase, const struct cache_stats *before,
+        const struct cache_stats *after)
+{
+  long long hits = after->hits - before->hits;
+  long long misses = after->misses - before->misses;
+  long long total = hits + misses;
+
+  printf ("%-8s %8lld hits %8lld misses %4lld%% hit rate\n", phase,
+          hits, misses, total > 0 ? hits * 100 / total : 0);
+}
+
+int
+main (void)
+{
+  struct cache_stats start, before, after;
+  struct cache_stats hot, stream;
+  char name[16];
+  int i;
+
+  for (i = 0; i < HOT_CNT; i++)
+    {
+      hot_name (name, i);
+      make_file (name, HOT_SIZE);
+    }
+  make_file ("stream", STREAM_SIZE);
+
+  /* Warm up the hot set so it has been referenced more than
+     once before the first scan. */
+  read_hot_set ();
+  read_hot_set ();
+
+  memset (&hot, 0, sizeof hot);
+  memset (&stream, 0, sizeof stream);
+  get_stats (&start);
+  for (i = 0; i < ROUNDS; i++)
+    {
+      get_stats (&before);
+      read_file ("stream");
+      get_stats (&after);
+      stream.hits += after.hits - before.hits;
+      stream.misses += after.misses - before.misses;
+
+      before = after;
+      read_hot_set ();
+      get_stats (&after);
+      hot.hits += after.hits - before.hits;
+      hot.misses += after.misses - before.misses;
+    }
+
+  memset (&before, 0, sizeof before);
+  report ("hot", &before, &hot);
+  report ("stream", &before, &stream);
+  report ("total", &start, &after);
+  printf ("evictions %lld\n", after.evictions - start.evictions);
+  return EXIT_SUCCESS;
+}
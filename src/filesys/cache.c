@@ -1,219 +1,1125 @@
 #include "filesys/cache.h"
 #include <debug.h>
+#include <hash.h>
+#include <round.h>
+#include <stdlib.h>
 #include <string.h>
+#include "threads/interrupt.h"
 #include "threads/malloc.h"
 #include "threads/thread.h"
+#include "threads/vaddr.h"
 #include "filesys/filesys.h"
+#include "filesys/free-map.h"
+#include "filesys/inode.h"
 #include "devices/timer.h"
 
+/* Maximum number of pending read-ahead requests. */
+#define READ_AHEAD_MAX 16
 
+/* Dirty slot count at which the write-back thread is woken
+   without waiting for its timer. */
+#define DIRTY_HIGH_WATER ((cache_size + 1) / 2)
+
+/* Maximum number of sectors cache_read_run() and cache_write_run()
+   hold locked at once: RUN_MAX, which CACHE_SIZE_MIN keeps within
+   RUN_PINNED_MAX. */
+#define RUN_LIMIT (RUN_MAX < cache_size / 4 ? RUN_MAX \
+                   : cache_size / 4 > 0 ? cache_size / 4 : 1)
+
+/* Maximum number of slots that runs of all threads together hold
+   locked: a quarter of the cache.  With at most DELAYED_MAX
+   delayed slots, a quarter of the cache is always left for
+   eviction, however many threads transfer runs at once. */
+#define RUN_PINNED_MAX (cache_size / 4)
+
+/* Maximum number of delayed sectors, which cannot be evicted.
+   The write-back thread is woken to assign them disk sectors once
+   half of these are in use. */
+#define DELAYED_MAX (cache_size / 2)
+
+size_t cache_size = CACHE_SIZE_DEFAULT;
+
+/* Slots and their hash index, allocated by cache_init(). */
+static struct cache_entry *cache_slots;     /* cache_size slots. */
+static struct list *cache_buckets;          /* Sector -> slot. */
+static size_t cache_bucket_cnt;             /* Power of 2. */
+
+/* Guards the bucket index, the replacement policy's state and
+   slot identity.  Never held across disk I/O. */
+static struct lock cache_lock;
+
+/* A replacement policy.  Every hook is called with cache_lock
+   held and must not block. */
+struct cache_policy
+  {
+    const char *name;                           /* For "-cache-policy". */
+    void (*init) (void);                        /* Called once at boot. */
+    void (*insert) (struct cache_entry *);      /* Slot just loaded. */
+    void (*touch) (struct cache_entry *);       /* Slot hit. */
+    void (*remove) (struct cache_entry *);      /* Slot claimed by evict. */
+    void (*forget) (disk_sector_t);             /* Sector freed on disk. */
+
+    /* Returns the eviction candidate to try after PREV, or the
+       first one if PREV is null.  Returns a null pointer once no
+       candidates are left.  May return free slots. */
+    struct cache_entry *(*victim) (struct cache_entry *prev);
+  };
+
+static const struct cache_policy clock_policy;
+static const struct cache_policy twoq_policy;
+static const struct cache_policy *const cache_policies[] =
+  {
+    &clock_policy,
+    &twoq_policy,
+  };
+static const struct cache_policy *policy = &clock_policy;
+
+/* Clock state. */
+static size_t clock_hand;                   /* Next slot to examine. */
+
+/* 2Q state.  Slots are kept on one of three queues: free slots,
+   A1in for sectors referenced once, in FIFO order, and Am for
+   sectors referenced again, in LRU order.  A1out remembers the
+   sector numbers recently evicted from A1in; a miss on one of
+   them goes straight to Am.  A sequential scan thus only cycles
+   through A1in and leaves Am alone. */
+#define TWOQ_GHOST_EMPTY ((disk_sector_t) -1)
+
+/* An A1out entry.  Besides the ring, which gives their age, the
+   entries in use are indexed by sector in twoq_ghost_buckets, so
+   that a miss finds out whether it is a ghost without scanning
+   the ring. */
+struct twoq_ghost
+  {
+    disk_sector_t sector_no;    /* Evicted sector or TWOQ_GHOST_EMPTY. */
+    struct list_elem elem;      /* In a twoq_ghost_buckets chain. */
+  };
+
+static struct list twoq_free;
+static struct list twoq_a1in;               /* Newest at the front. */
+static struct list twoq_am;                 /* Most recent at the front. */
+static size_t twoq_a1in_cnt;                /* Slots on A1in. */
+static size_t twoq_kin;                     /* Target size of A1in. */
+static struct twoq_ghost *twoq_a1out;       /* Ring of evicted sectors. */
+static size_t twoq_kout;                    /* Entries in twoq_a1out. */
+static size_t twoq_a1out_pos;               /* Next entry to overwrite. */
+static struct list *twoq_ghost_buckets;     /* Sector -> A1out entry. */
+static size_t twoq_ghost_bucket_cnt;        /* Power of 2. */
+static struct list *twoq_first;             /* Queue a victim scan began in. */
+
+/* Read-ahead requests, a ring buffer drained by read_ahead_thread.
+   Requests that arrive while it is full are dropped. */
+static disk_sector_t read_ahead_queue[READ_AHEAD_MAX];
+static size_t read_ahead_head;          /* Index of oldest request. */
+static size_t read_ahead_cnt;           /* Number of requests queued. */
+static struct lock read_ahead_lock;
+static struct condition read_ahead_cond;    /* Signaled on enqueue. */
+
+/* Write-back state. */
+static size_t dirty_cnt;                /* Number of dirty slots. */
+static struct semaphore write_back_sema;    /* Up'd to start a flush. */
+static struct lock flush_lock;          /* Serializes cache_flush(). */
+static struct cache_entry **flush_slots;    /* Dirty snapshot. */
+static const void **flush_buffers;          /* Data of one run. */
+
+/* Slots held locked by runs, all threads together.  Guarded by
+   run_lock; run_cond is signaled when it drops. */
+static size_t run_pinned;
+static struct lock run_lock;
+static struct condition run_cond;
+
+/* Delayed sectors, guarded by cache_lock. */
+static size_t delayed_cnt;              /* Handed out, not yet assigned. */
+static disk_sector_t next_delayed;      /* Next number to hand out. */
+
+/* Statistics, guarded by cache_lock. */
+static struct cache_stats stats;
 
 static thread_func read_ahead_thread;
 static thread_func write_back_thread;
+static thread_func write_back_timer;
 
-unsigned cache_hash (const struct hash_elem *p_, void *aux UNUSED)
+static struct list *
+cache_bucket (disk_sector_t sector_no)
 {
-    const struct cache_entry *p = hash_entry(p_, struct cache_entry, elem);
-    return hash_bytes(&p->sector_no, sizeof (p->sector_no));
+    return &cache_buckets[hash_int (sector_no) & (cache_bucket_cnt - 1)];
 }
 
-bool cache_less (const struct hash_elem *a_, const struct hash_elem *b_, void *aux UNUSED)
+/* Selects the replacement policy called NAME, which must be
+   "clock" or "2q".  Returns false if there is no such policy.
+   Must be called before cache_init(). */
+bool cache_set_policy (const char *name)
 {
-    const struct cache_entry *a = hash_entry(a_, struct cache_entry, elem);
-    const struct cache_entry *b = hash_entry(b_, struct cache_entry, elem);
+    size_t i;
 
-    return a->sector_no < b->sector_no;
+    for (i = 0; i < sizeof cache_policies / sizeof *cache_policies; i++)
+        if (!strcmp (name, cache_policies[i]->name)) {
+            policy = cache_policies[i];
+            return true;
+        }
+    return false;
 }
 
-void cache_init () 
+/* Allocates cache_size slots, their data and their bookkeeping
+   from the kernel pool up front, so that cache misses never go
+   to the allocator. */
+void cache_init (void)
 {
-    hash_init(&buffer_cache, cache_hash, cache_less, NULL);
+    size_t meta_size, i;
+    void *meta;
+    uint8_t *data;
+
+    if (cache_size < CACHE_SIZE_MIN)
+        PANIC ("buffer cache must hold at least %d sectors", CACHE_SIZE_MIN);
+
+    /* About two slots per bucket. */
+    cache_bucket_cnt = 4;
+    while (cache_bucket_cnt < cache_size / 2)
+        cache_bucket_cnt *= 2;
+
+    meta_size = cache_size * (sizeof *cache_slots + sizeof *flush_slots
+                              + sizeof *flush_buffers)
+                + cache_bucket_cnt * sizeof *cache_buckets;
+    meta = palloc_get_multiple (0, DIV_ROUND_UP (meta_size, PGSIZE));
+    data = palloc_get_multiple (0, DIV_ROUND_UP (cache_size * DISK_SECTOR_SIZE,
+                                                 PGSIZE));
+    if (meta == NULL || data == NULL)
+        PANIC ("buffer cache of %zu sectors does not fit in the kernel pool",
+               cache_size);
+    cache_slots = meta;
+    cache_buckets = (struct list *) (cache_slots + cache_size);
+    flush_slots = (struct cache_entry **) (cache_buckets + cache_bucket_cnt);
+    flush_buffers = (const void **) (flush_slots + cache_size);
+
+    for (i = 0; i < cache_bucket_cnt; i++)
+        list_init (&cache_buckets[i]);
+    for (i = 0; i < cache_size; i++) {
+        struct cache_entry *ce = &cache_slots[i];
+        lock_init (&ce->lock);
+        ce->in_use = false;
+        ce->used = false;
+        ce->dirty = false;
+        ce->prefetched = false;
+        ce->data = data + i * DISK_SECTOR_SIZE;
+    }
     lock_init(&cache_lock);
+    policy->init ();
+
+    read_ahead_head = read_ahead_cnt = 0;
+    lock_init (&read_ahead_lock);
+    cond_init (&read_ahead_cond);
+
+    run_pinned = 0;
+    lock_init (&run_lock);
+    cond_init (&run_cond);
+
+    dirty_cnt = 0;
+    delayed_cnt = 0;
+    next_delayed = CACHE_DELAYED_BASE;
+    sema_init (&write_back_sema, 0);
+    lock_init (&flush_lock);
+
     thread_create("write-back", PRI_DEFAULT, write_back_thread, NULL);
+    thread_create("flush-timer", PRI_DEFAULT, write_back_timer, NULL);
+    thread_create("read-ahead", PRI_DEFAULT, read_ahead_thread, NULL);
 }
 
-struct cache_entry * cache_lookup(disk_sector_t sector_no)
+/* Marks CE, whose lock must be held, as dirty.  Wakes the
+   write-back thread when the number of dirty slots reaches
+   DIRTY_HIGH_WATER. */
+static void cache_mark_dirty(struct cache_entry *ce)
 {
-    struct cache_entry c;
-    struct hash_elem *e;
+    enum intr_level old_level;
+    bool wake;
+
+    if (ce->dirty)
+        return;
+    old_level = intr_disable ();
+    ce->dirty = true;
+    wake = ++dirty_cnt == DIRTY_HIGH_WATER;
+    intr_set_level (old_level);
 
-    c.sector_no = sector_no;
-    e = hash_find(&buffer_cache, &c.elem);
-    return e != NULL ? hash_entry (e, struct cache_entry, elem) : NULL;
+    if (wake)
+        sema_up (&write_back_sema);
 }
 
+/* Marks CE, whose lock must be held, as clean. */
+static void cache_mark_clean(struct cache_entry *ce)
+{
+    enum intr_level old_level;
+
+    if (!ce->dirty)
+        return;
+    old_level = intr_disable ();
+    ce->dirty = false;
+    dirty_cnt--;
+    intr_set_level (old_level);
+}
+
+/* Called with cache_lock held. */
+static struct cache_entry * cache_lookup(disk_sector_t sector_no)
+{
+    struct list *bucket = cache_bucket (sector_no);
+    struct list_elem *e;
+
+    for (e = list_begin (bucket); e != list_end (bucket); e = list_next (e)) {
+        struct cache_entry *ce = list_entry (e, struct cache_entry, elem);
+        if (ce->sector_no == sector_no)
+            return ce;
+    }
+    return NULL;
+}
+
+/* Drops CE from the index, discarding its contents.  It stays
+   with the replacement policy as a free slot until evicted.
+   Called with cache_lock and CE's lock held. */
+static void cache_invalidate(struct cache_entry *ce)
+{
+    list_remove (&ce->elem);
+    ce->in_use = false;
+    ce->prefetched = false;
+    cache_mark_clean(ce);
+}
+
+/* Clock: a single reference bit per slot.  The hand keeps its
+   position between calls, so each eviction resumes where the
+   last one stopped. */
+
+static void clock_init (void)
+{
+    clock_hand = 0;
+}
+
+static void clock_insert (struct cache_entry *ce)
+{
+    ce->used = true;
+}
+
+static void clock_touch (struct cache_entry *ce)
+{
+    ce->used = true;
+}
+
+static void clock_remove (struct cache_entry *ce UNUSED)
+{
+}
+
+/* Advances the hand to the next free slot or the next one whose
+   reference bit is clear, clearing bits on the way.  Ends within
+   one sweep, since the bits it clears stay clear while
+   cache_lock is held. */
+static struct cache_entry * clock_victim (struct cache_entry *prev UNUSED)
+{
+    while (true) {
+        struct cache_entry *ce = &cache_slots[clock_hand];
+        clock_hand = (clock_hand + 1) % cache_size;
+
+        if (ce->in_use && ce->used == true) {
+            ce->used = false;
+            continue;
+        }
+        return ce;
+    }
+}
+
+static const struct cache_policy clock_policy =
+  {
+    "clock", clock_init, clock_insert, clock_touch, clock_remove, NULL,
+    clock_victim,
+  };
+
+/* 2Q, after Johnson and Shasha, with A1in at a quarter of the
+   cache and A1out remembering half as many sectors as the cache
+   holds. */
+
+static void twoq_init (void)
+{
+    size_t i;
+
+    list_init (&twoq_free);
+    list_init (&twoq_a1in);
+    list_init (&twoq_am);
+    twoq_a1in_cnt = 0;
+    twoq_kin = cache_size / 4 > 0 ? cache_size / 4 : 1;
+    twoq_kout = cache_size / 2 > 0 ? cache_size / 2 : 1;
 
-//[TODO 1] read_in_cache : Cache hit - return data / Cache miss - insert new entry
-//[TODO 2-1] cache_evict : if cache is full - evict one by clock algorithm
+    /* About two ghosts per bucket. */
+    twoq_ghost_bucket_cnt = 4;
+    while (twoq_ghost_bucket_cnt < twoq_kout / 2)
+        twoq_ghost_bucket_cnt *= 2;
 
-//[TODO 2-2] cache_insert : Insert a new cache entry(if Cache miss) handle evict inside
-//[TODO 3] implement read-ahead policy
-void cache_insert(struct cache_entry *new_entry)
+    twoq_a1out = malloc (twoq_kout * sizeof *twoq_a1out);
+    twoq_ghost_buckets = malloc (twoq_ghost_bucket_cnt
+                                 * sizeof *twoq_ghost_buckets);
+    if (twoq_a1out == NULL || twoq_ghost_buckets == NULL)
+        PANIC ("cannot allocate 2Q ghost queue");
+    for (i = 0; i < twoq_kout; i++)
+        twoq_a1out[i].sector_no = TWOQ_GHOST_EMPTY;
+    for (i = 0; i < twoq_ghost_bucket_cnt; i++)
+        list_init (&twoq_ghost_buckets[i]);
+    twoq_a1out_pos = 0;
+
+    for (i = 0; i < cache_size; i++) {
+        cache_slots[i].queue = &twoq_free;
+        list_push_back (&twoq_free, &cache_slots[i].policy_elem);
+    }
+}
+
+/* Returns the A1out bucket for SECTOR_NO. */
+static struct list *
+twoq_ghost_bucket (disk_sector_t sector_no)
 {
-    ASSERT(cache_lookup(new_entry->sector_no) == NULL);
+    return &twoq_ghost_buckets[hash_int (sector_no)
+                               & (twoq_ghost_bucket_cnt - 1)];
+}
 
-    int currsize = hash_size(&buffer_cache);
-    if (currsize < 64) {
-        //printf("insert entry : %d\n", new_entry->sector_no);
-        hash_insert(&buffer_cache, &new_entry->elem);
+/* Removes the A1out entry for SECTOR_NO, if there is one, and
+   returns true if there was. */
+static bool twoq_ghost_take (disk_sector_t sector_no)
+{
+    struct list *bucket = twoq_ghost_bucket (sector_no);
+    struct list_elem *e;
+
+    for (e = list_begin (bucket); e != list_end (bucket); e = list_next (e)) {
+        struct twoq_ghost *g = list_entry (e, struct twoq_ghost, elem);
+        if (g->sector_no == sector_no) {
+            list_remove (&g->elem);
+            g->sector_no = TWOQ_GHOST_EMPTY;
+            return true;
+        }
+    }
+    return false;
+}
+
+/* Puts CE on Am if its sector was recently evicted from A1in,
+   otherwise on A1in. */
+static void twoq_insert (struct cache_entry *ce)
+{
+    if (twoq_ghost_take (ce->sector_no)) {
+        ce->queue = &twoq_am;
+        list_push_front (&twoq_am, &ce->policy_elem);
         return;
     }
-    //printf("cache entry should be evicted!\n");
-    cache_evict();
-    hash_insert(&buffer_cache, &new_entry->elem);
+    ce->queue = &twoq_a1in;
+    list_push_front (&twoq_a1in, &ce->policy_elem);
+    twoq_a1in_cnt++;
 }
 
-void cache_evict() {    //LIMITATION : cannot save iterator
-    struct hash_iterator i;
-    hash_first (&i, &buffer_cache);
-    while (true)
+/* Moves CE to the front of Am if it is there.  A hit in A1in
+   does not promote it: back-to-back accesses to one sector are
+   a single reference as far as 2Q is concerned. */
+static void twoq_touch (struct cache_entry *ce)
+{
+    if (ce->queue == &twoq_am) {
+        list_remove (&ce->policy_elem);
+        list_push_front (&twoq_am, &ce->policy_elem);
+    }
+}
+
+/* Takes CE off its queue, remembering its sector in A1out, in
+   place of the oldest entry, if it came from A1in.  A slot that
+   was invalidated holds no sector worth remembering. */
+static void twoq_remove (struct cache_entry *ce)
+{
+    list_remove (&ce->policy_elem);
+    if (ce->queue == &twoq_a1in) {
+        twoq_a1in_cnt--;
+        if (ce->in_use) {
+            struct twoq_ghost *g = &twoq_a1out[twoq_a1out_pos];
+
+            if (g->sector_no != TWOQ_GHOST_EMPTY)
+                list_remove (&g->elem);
+            g->sector_no = ce->sector_no;
+            list_push_front (twoq_ghost_bucket (g->sector_no), &g->elem);
+            twoq_a1out_pos = (twoq_a1out_pos + 1) % twoq_kout;
+        }
+    }
+    ce->queue = NULL;
+}
+
+/* Forgets SECTOR_NO's A1out entry, since its next use will be
+   unrelated to its last. */
+static void twoq_forget (disk_sector_t sector_no)
+{
+    twoq_ghost_take (sector_no);
+}
+
+/* Offers a free slot if there is one.  Otherwise walks A1in from
+   its oldest slot if it is over its target size, or Am from its
+   least recently used one, then falls back to the other queue. */
+static struct cache_entry * twoq_victim (struct cache_entry *prev)
+{
+    struct list *q;
+    struct list_elem *e;
+
+    if (prev == NULL || prev->queue == &twoq_free) {
+        if (prev == NULL && !list_empty (&twoq_free))
+            return list_entry (list_front (&twoq_free), struct cache_entry,
+                               policy_elem);
+        twoq_first = (twoq_a1in_cnt > twoq_kin || list_empty (&twoq_am)
+                      ? &twoq_a1in : &twoq_am);
+        q = twoq_first;
+        e = list_rbegin (q);
+    } else {
+        q = prev->queue;
+        e = list_prev (&prev->policy_elem);
+    }
+
+    if (e == list_rend (q)) {
+        if (q != twoq_first)
+            return NULL;
+        q = q == &twoq_a1in ? &twoq_am : &twoq_a1in;
+        e = list_rbegin (q);
+        if (e == list_rend (q))
+            return NULL;
+    }
+    return list_entry (e, struct cache_entry, policy_elem);
+}
+
+static const struct cache_policy twoq_policy =
+  {
+    "2q", twoq_init, twoq_insert, twoq_touch, twoq_remove, twoq_forget,
+    twoq_victim,
+  };
+
+/* Walks the policy's eviction candidates until it finds one whose
+   lock is free.  Slots the running thread already holds, such as
+   an index block pinned while map_entry() allocates beneath it,
+   are skipped rather than try-locked, which would be a recursive
+   acquire.
+
+   Called with cache_lock held.  On success returns a clean slot,
+   removed from the index and from the policy, with its lock held,
+   and cache_lock is still held.  If the victim is dirty, drops
+   cache_lock, writes it back under the slot lock alone and
+   returns NULL so that the caller retries; the slot stays indexed
+   meanwhile, so lookups of the old sector wait for the write
+   instead of reading stale data from disk.  Also drops cache_lock
+   and returns NULL if every slot is busy. */
+static struct cache_entry * cache_evict(void)
+{
+    struct cache_entry *ce = NULL;
+    size_t tries;
+
+    for (tries = 0; tries < 2 * cache_size; tries++)
     {
-        if (hash_next (&i) == NULL) {
-            hash_first(&i, &buffer_cache);
-            hash_next (&i);
+        ce = policy->victim (ce);
+        if (ce == NULL)
+            break;
+        if (ce->in_use && cache_is_delayed (ce->sector_no))
+            continue;
+        if (lock_held_by_current_thread (&ce->lock))
+            continue;
+        if (!lock_try_acquire (&ce->lock))
+            continue;
+
+        if (ce->in_use && ce->dirty == true) {
+            stats.dirty_evictions++;
+            lock_release(&cache_lock);
+            disk_write(filesys_disk, ce->sector_no, ce->data);
+            cache_mark_clean(ce);
+            lock_release (&ce->lock);
+            return NULL;
+        }
+        //Evict this entry!
+        policy->remove (ce);
+        if (ce->in_use) {
+            list_remove (&ce->elem);
+            stats.evictions++;
+            if (ce->prefetched)
+                stats.read_ahead_wasted++;
         }
+        ce->in_use = false;
+        ce->prefetched = false;
+        return ce;
+    }
 
-        struct cache_entry *ce = hash_entry (hash_cur (&i), struct cache_entry, elem);
-        //printf("cache entry %d\n", ce->sector_no);
-        if (ce->used == true)
-            ce->used = false;
-        else {  //Evict this entry!
-            hash_delete(&buffer_cache, &ce->elem);
-            if (ce->dirty == true) {
-                disk_write(filesys_disk, ce->sector_no, ce->data);
+    lock_release(&cache_lock);
+    thread_yield ();
+    return NULL;
+}
+
+/* Returns the slot holding SECTOR_NO with its lock held, and sets
+   *HITP to whether it was already there.  On a miss, claims a slot
+   for SECTOR_NO and leaves loading its data to the caller, which
+   must do so before releasing the lock.  cache_lock is released
+   before returning.  PREFETCH is true for read-ahead, which is
+   counted apart from real accesses. */
+static struct cache_entry * cache_claim(disk_sector_t sector_no,
+                                        bool prefetch, bool *hitp)
+{
+    struct cache_entry *ce;
+
+    while (true) {
+        lock_acquire(&cache_lock);
+        ce = cache_lookup(sector_no);
+        if (ce != NULL) {
+            /* Cache hit: wait out any load or write-back of the
+               slot, then make sure it was not recycled meanwhile. */
+            if (!prefetch)
+                policy->touch (ce);
+            lock_release(&cache_lock);
+            lock_acquire (&ce->lock);
+            if (ce->in_use && ce->sector_no == sector_no) {
+                if (!prefetch) {
+                    lock_acquire(&cache_lock);
+                    stats.hits++;
+                    if (ce->prefetched) {
+                        ce->prefetched = false;
+                        stats.read_ahead_used++;
+                    }
+                    lock_release(&cache_lock);
+                }
+                *hitp = true;
+                return ce;
             }
-            //printf("evicted %d\n", ce->sector_no);
-            free(ce->data);
-            free(ce);
-            return;
+            lock_release (&ce->lock);
+            continue;
         }
 
+        /* Cache miss */
+        ce = cache_evict();
+        if (ce == NULL)
+            continue;
+        ce->sector_no = sector_no;
+        ce->in_use = true;
+        ce->prefetched = prefetch;
+        list_push_front (cache_bucket (sector_no), &ce->elem);
+        policy->insert (ce);
+        if (prefetch)
+            stats.read_ahead_issued++;
+        else
+            stats.misses++;
+        lock_release(&cache_lock);
+
+        *hitp = false;
+        return ce;
     }
 }
-int read_in_cache(disk_sector_t sector_idx, int sector_ofs, void *buffer, int readsize)
+
+/* Returns the slot holding SECTOR_NO with its lock held.  On a
+   miss, claims a slot and reads the sector in from disk, or
+   zero-fills the slot if FILL is false because the caller is
+   about to overwrite the whole sector or if SECTOR_NO is a
+   delayed sector, which starts out as zeros.  cache_lock is
+   released before any disk I/O.  PREFETCH is true for read-ahead,
+   which is counted apart from real accesses. */
+static struct cache_entry * cache_acquire(disk_sector_t sector_no, bool fill,
+                                          bool prefetch)
 {
-    //printf("File Read : %d\n", sector_idx);
+    bool hit;
+    struct cache_entry *ce = cache_claim(sector_no, prefetch, &hit);
+
+    if (!hit) {
+        if (fill && !cache_is_delayed (sector_no))
+            disk_read(filesys_disk, sector_no, ce->data);
+        else
+            memset(ce->data, 0, DISK_SECTOR_SIZE);
+    }
+    return ce;
+}
+
+/* Returns a pointer to the cached contents of SECTOR_NO, reading
+   it in on a miss.  The slot stays pinned, with its lock held,
+   until released with cache_put(), so the caller may read or
+   modify the sector in place.  A thread must not pin the same
+   sector twice, or touch it through read_in_cache() or
+   write_to_cache() while pinned.  Pin parent index blocks before
+   their children so that pinners cannot deadlock. */
+void *cache_get(disk_sector_t sector_no)
+{
+    return cache_acquire(sector_no, true, false)->data;
+}
+
+/* Like cache_get(), but for a sector about to be initialized: its
+   contents are zeroed rather than read in from disk. */
+void *cache_get_blank(disk_sector_t sector_no)
+{
+    struct cache_entry *ce = cache_acquire(sector_no, false, false);
+    memset(ce->data, 0, DISK_SECTOR_SIZE);
+    return ce->data;
+}
+
+/* Unpins SECTOR_NO, which the caller must have pinned with
+   cache_get() or cache_get_blank().  DIRTY must be true if the
+   sector was modified. */
+void cache_put(disk_sector_t sector_no, bool dirty)
+{
+    struct cache_entry *ce;
+
+    /* A pinned slot cannot change identity, so the lookup is
+       stable once cache_lock is dropped. */
     lock_acquire(&cache_lock);
-    struct cache_entry *ce = cache_lookup(sector_idx);
-    if (ce != NULL) {
-        /* Cache hit */
-         memcpy(buffer, ce->data + sector_ofs, readsize);
-         ce->used = true;
-         lock_release(&cache_lock);
-         return readsize;
-    }
-
-    /* Cache miss */
-    // 1. Make a new cache_entry
-    struct cache_entry *new_entry = malloc(sizeof (struct cache_entry));
-    new_entry->sector_no = sector_idx;
-    new_entry->used = true;
-    new_entry->dirty = false;
-    new_entry->data = malloc(DISK_SECTOR_SIZE); //Kernel pool?
-    cache_insert(new_entry);
-
-
-    // 2. read data from disk
-    disk_sector_t *aux = malloc(sizeof(disk_sector_t));
-    *aux = sector_idx + 1;
-    
-    //printf("thread_create for read-ahead\n");
-    //thread_create("read-ahead", PRI_DEFAULT, read_ahead_thread, (void*)aux);
-    disk_read(filesys_disk, sector_idx, new_entry->data);
-    // 3. copy to buffer by readsize
-    memcpy(buffer, new_entry->data + sector_ofs, readsize);
+    ce = cache_lookup(sector_no);
+    lock_release(&cache_lock);
+    ASSERT (ce != NULL && lock_held_by_current_thread (&ce->lock));
+
+    if (dirty)
+        cache_mark_dirty(ce);
+    lock_release (&ce->lock);
+}
 
+/* Returns a new delayed sector, which reads as zeros until
+   written, or 0 if DELAYED_MAX of them are already in use.  It
+   must eventually be given to cache_assign() or
+   cache_discard(). */
+disk_sector_t cache_new_delayed(void)
+{
+    disk_sector_t sector_no = 0;
+    bool wake = false;
+
+    lock_acquire(&cache_lock);
+    if (delayed_cnt < DELAYED_MAX) {
+        sector_no = next_delayed++;
+        if (next_delayed == 0)
+            next_delayed = CACHE_DELAYED_BASE;
+        wake = ++delayed_cnt == (DELAYED_MAX + 1) / 2;
+    }
     lock_release(&cache_lock);
-    return readsize;  
 
+    if (wake)
+        sema_up (&write_back_sema);
+    return sector_no;
 }
 
-static void
-read_ahead_thread (void *aux)
+/* Moves the contents of delayed sector DELAYED to SECTOR_NO, a
+   sector just allocated for it, and leaves them for write-back.
+   A stale slot left over for SECTOR_NO from before it was freed
+   is dropped.  Only the owner of DELAYED may access it, so its
+   slot cannot be busy. */
+void cache_assign(disk_sector_t delayed, disk_sector_t sector_no)
 {
-    disk_sector_t sector_no = *(disk_sector_t *)aux;
-    //printf("read_ahead thread : %d\n", sector_no);
+    struct cache_entry *ce, *stale;
+
+    ASSERT (cache_is_delayed (delayed) && !cache_is_delayed (sector_no));
+
     lock_acquire(&cache_lock);
-    struct cache_entry *ce = cache_lookup(sector_no);
-    if (ce != NULL) {
-        free(aux);
+    while ((stale = cache_lookup(sector_no)) != NULL) {
         lock_release(&cache_lock);
+        lock_acquire (&stale->lock);
+        lock_acquire(&cache_lock);
+        if (stale->in_use && stale->sector_no == sector_no)
+            cache_invalidate(stale);
+        lock_release (&stale->lock);
+    }
+    delayed_cnt--;
+
+    ce = cache_lookup(delayed);
+    if (ce == NULL) {
+        /* Never written, so still all zeros. */
+        lock_release(&cache_lock);
+        cache_get_blank(sector_no);
+        cache_put(sector_no, true);
         return;
     }
-    struct cache_entry *new_entry = malloc(sizeof (struct cache_entry));
-    new_entry->sector_no = sector_no;
-    new_entry->used = true;
-    new_entry->dirty = false;
-    new_entry->data = malloc(DISK_SECTOR_SIZE);
-    cache_insert(new_entry);
+    lock_acquire (&ce->lock);
+    list_remove (&ce->elem);
+    ce->sector_no = sector_no;
+    list_push_front (cache_bucket (sector_no), &ce->elem);
+    lock_release(&cache_lock);
+
+    cache_mark_dirty(ce);
+    lock_release (&ce->lock);
+}
+
+/* Throws away delayed sector DELAYED, whose file was deleted. */
+void cache_discard(disk_sector_t delayed)
+{
+    struct cache_entry *ce;
+
+    ASSERT (cache_is_delayed (delayed));
+
+    lock_acquire(&cache_lock);
+    delayed_cnt--;
+    ce = cache_lookup(delayed);
+    if (ce != NULL) {
+        lock_acquire (&ce->lock);
+        cache_invalidate(ce);
+        lock_release (&ce->lock);
+    }
+    lock_release(&cache_lock);
+}
 
+/* Tells the replacement policy that the CNT sectors starting at
+   SECTOR_NO were freed, so that whatever it remembers about them
+   does not carry over to their next, unrelated use. */
+void cache_forget(disk_sector_t sector_no, size_t cnt)
+{
+    size_t i;
 
-    disk_read(filesys_disk, sector_no, new_entry->data);
+    if (policy->forget == NULL)
+        return;
+    lock_acquire(&cache_lock);
+    for (i = 0; i < cnt; i++)
+        policy->forget (sector_no + i);
     lock_release(&cache_lock);
+}
+
+/* Returns true if SECTOR_NO is resident in the cache. */
+static bool cache_contains(disk_sector_t sector_no)
+{
+    bool found;
 
-    free(aux);
+    lock_acquire(&cache_lock);
+    found = cache_lookup(sector_no) != NULL;
+    lock_release(&cache_lock);
+    return found;
 }
 
+/* Queues SECTOR_NO to be read into the cache in the background
+   and returns without waiting for it.  Does nothing if the sector
+   is already cached or queued, lies past the end of the disk, or
+   the queue is full. */
+void cache_read_ahead(disk_sector_t sector_no)
+{
+    size_t i;
+
+    if (sector_no >= disk_size (filesys_disk) || cache_contains(sector_no))
+        return;
+
+    lock_acquire (&read_ahead_lock);
+    for (i = 0; i < read_ahead_cnt; i++)
+        if (read_ahead_queue[(read_ahead_head + i) % READ_AHEAD_MAX] == sector_no)
+            break;
+    if (i == read_ahead_cnt && read_ahead_cnt < READ_AHEAD_MAX) {
+        read_ahead_queue[(read_ahead_head + read_ahead_cnt) % READ_AHEAD_MAX] = sector_no;
+        read_ahead_cnt++;
+        cond_signal (&read_ahead_cond, &read_ahead_lock);
+    }
+    lock_release (&read_ahead_lock);
+}
+
+int read_in_cache(disk_sector_t sector_idx, int sector_ofs, void *buffer, int readsize)
+{
+    struct cache_entry *ce = cache_acquire(sector_idx, true, false);
+    memcpy(buffer, ce->data + sector_ofs, readsize);
+    lock_release (&ce->lock);
+    return readsize;
+}
+
+/* Waits until CNT more slots may be held locked by runs without
+   exceeding RUN_PINNED_MAX, and counts them as held.  CNT must not
+   exceed RUN_LIMIT. */
 static void
-write_back_thread (void *aux UNUSED)
+run_reserve (size_t cnt)
+{
+    lock_acquire (&run_lock);
+    while (run_pinned + cnt > RUN_PINNED_MAX)
+        cond_wait (&run_cond, &run_lock);
+    run_pinned += cnt;
+    lock_release (&run_lock);
+}
+
+/* Gives back CNT slots counted by run_reserve(), whose locks the
+   caller has released. */
+static void
+run_unreserve (size_t cnt)
+{
+    lock_acquire (&run_lock);
+    run_pinned -= cnt;
+    cond_broadcast (&run_cond, &run_lock);
+    lock_release (&run_lock);
+}
+
+/* Claims the slots for the CNT consecutive sectors starting at
+   START, in ascending order so that runs of different threads
+   cannot deadlock, and stores them into SLOTS with their locks
+   held.  Every slot that missed and for which NEED_DATA returns
+   true is then loaded, each run of consecutive ones with a single
+   multi-sector transfer; other misses are zeroed.  CNT must not
+   exceed RUN_MAX, and the caller must have reserved CNT slots
+   with run_reserve(). */
+static void
+cache_claim_run (disk_sector_t start, size_t cnt,
+                 struct cache_entry *slots[],
+                 bool (*need_data) (size_t idx, size_t cnt, void *aux),
+                 void *aux)
+{
+    bool load[RUN_MAX];
+    void *buffers[RUN_MAX];
+    size_t i, j;
+
+    ASSERT (cnt <= RUN_MAX);
+
+    for (i = 0; i < cnt; i++) {
+        bool hit;
+
+        slots[i] = cache_claim(start + i, false, &hit);
+        load[i] = (!hit && !cache_is_delayed (start + i)
+                   && need_data (i, cnt, aux));
+        if (!hit && !load[i])
+            memset(slots[i]->data, 0, DISK_SECTOR_SIZE);
+    }
+
+    for (i = 0; i < cnt; i = j) {
+        if (!load[i]) {
+            j = i + 1;
+            continue;
+        }
+        for (j = i; j < cnt && load[j]; j++)
+            buffers[j - i] = slots[j]->data;
+        disk_read_multiple(filesys_disk, start + i, j - i, buffers);
+    }
+}
+
+/* Every sector of a read is needed. */
+static bool
+read_needs_data (size_t idx UNUSED, size_t cnt UNUSED, void *aux UNUSED)
+{
+    return true;
+}
+
+/* Copies SIZE bytes into BUFFER from consecutive sectors, starting
+   at byte SECTOR_OFS of sector SECTOR_IDX.  The sectors are handled
+   in batches; in each, the misses are read in with as few disk
+   requests as possible, one per run of consecutive misses. */
+void cache_read_run(disk_sector_t sector_idx, int sector_ofs, void *buffer,
+                    int size)
+{
+    struct cache_entry *slots[RUN_MAX];
+    uint8_t *dst = buffer;
+
+    while (size > 0) {
+        size_t cnt = DIV_ROUND_UP (sector_ofs + size, DISK_SECTOR_SIZE);
+        size_t i;
+
+        if (cnt > RUN_LIMIT)
+            cnt = RUN_LIMIT;
+        run_reserve (cnt);
+        cache_claim_run(sector_idx, cnt, slots, read_needs_data, NULL);
+        for (i = 0; i < cnt; i++) {
+            int chunk = DISK_SECTOR_SIZE - sector_ofs;
+            if (chunk > size)
+                chunk = size;
+            memcpy(dst, slots[i]->data + sector_ofs, chunk);
+            lock_release (&slots[i]->lock);
+            dst += chunk;
+            size -= chunk;
+            sector_ofs = 0;
+        }
+        run_unreserve (cnt);
+        sector_idx += cnt;
+    }
+}
+
+/* Where a write batch begins and ends within its sectors. */
+struct write_span
+{
+    int first_ofs;              /* Byte offset in the first sector. */
+    int last_end;               /* End offset in the last sector. */
+};
+
+/* A sector of a write is needed unless the write covers it all. */
+static bool
+write_needs_data (size_t idx, size_t cnt, void *span_)
+{
+    struct write_span *span = span_;
+
+    return ((idx == 0 && span->first_ofs > 0)
+            || (idx == cnt - 1 && span->last_end < DISK_SECTOR_SIZE));
+}
+
+/* Copies SIZE bytes from BUFFER into consecutive sectors, starting
+   at byte SECTOR_OFS of sector SECTOR_IDX.  Only a partially
+   written first or last sector is read in on a miss. */
+void cache_write_run(disk_sector_t sector_idx, int sector_ofs,
+                     const void *buffer, int size)
+{
+    struct cache_entry *slots[RUN_MAX];
+    const uint8_t *src = buffer;
+
+    while (size > 0) {
+        size_t cnt = DIV_ROUND_UP (sector_ofs + size, DISK_SECTOR_SIZE);
+        struct write_span span;
+        size_t i;
+
+        if (cnt > RUN_LIMIT)
+            cnt = RUN_LIMIT;
+        span.first_ofs = sector_ofs;
+        span.last_end = DISK_SECTOR_SIZE;
+        if (sector_ofs + size < (int) (cnt * DISK_SECTOR_SIZE))
+            span.last_end = (sector_ofs + size) % DISK_SECTOR_SIZE;
+        run_reserve (cnt);
+        cache_claim_run(sector_idx, cnt, slots, write_needs_data, &span);
+        for (i = 0; i < cnt; i++) {
+            int chunk = DISK_SECTOR_SIZE - sector_ofs;
+            if (chunk > size)
+                chunk = size;
+            memcpy(slots[i]->data + sector_ofs, src, chunk);
+            cache_mark_dirty(slots[i]);
+            lock_release (&slots[i]->lock);
+            src += chunk;
+            size -= chunk;
+            sector_ofs = 0;
+        }
+        run_unreserve (cnt);
+        sector_idx += cnt;
+    }
+}
+
+/* Drains the read-ahead queue, loading each sector that is still
+   not resident. */
+static void
+read_ahead_thread (void *aux UNUSED)
 {
     while (true)
     {
-        timer_sleep(5*TIMER_FREQ);
-        //printf("Write back time!\n");
-        lock_acquire(&cache_lock);
-        struct hash_iterator i;
-        hash_first (&i, &buffer_cache);
-        while (hash_next(&i))
-        {
-           struct cache_entry *ce = hash_entry (hash_cur (&i), struct cache_entry, elem);
-           if (ce->dirty == true) {
-               disk_write(filesys_disk, ce->sector_no, ce->data);
-               ce->dirty = false;
-           }
+        disk_sector_t sector_no;
+
+        lock_acquire (&read_ahead_lock);
+        while (read_ahead_cnt == 0)
+            cond_wait (&read_ahead_cond, &read_ahead_lock);
+        sector_no = read_ahead_queue[read_ahead_head];
+        read_ahead_head = (read_ahead_head + 1) % READ_AHEAD_MAX;
+        read_ahead_cnt--;
+        lock_release (&read_ahead_lock);
+
+        if (!cache_contains(sector_no)) {
+            struct cache_entry *ce = cache_acquire(sector_no, true, true);
+            lock_release (&ce->lock);
         }
-        lock_release(&cache_lock); 
     }
 }
-//[TODO 4] write_to_cache : Cache hit - modify data / Cache miss - insert new entry to cache
 
-int write_to_cache(disk_sector_t sector_idx, int sector_ofs, void *buffer, int length, bool partial)
+/* Orders cache slots by sector number. */
+static int
+flush_compare (const void *a_, const void *b_, void *aux UNUSED)
 {
-    //printf("File write : %d\n", sector_idx);
-    lock_acquire(&cache_lock);
-    struct cache_entry *ce = cache_lookup(sector_idx);
-    if (ce != NULL) {
-        /* Cache hit */
-        //No difference between partial copy and full
-        memcpy(ce->data + sector_ofs, buffer, length);
-        ce->used = true;
-        ce->dirty = true;
+    const struct cache_entry *a = *(struct cache_entry *const *) a_;
+    const struct cache_entry *b = *(struct cache_entry *const *) b_;
+
+    return a->sector_no < b->sector_no ? -1 : a->sector_no > b->sector_no;
+}
+
+/* Writes every dirty slot back to disk in ascending sector order,
+   handing each run of consecutive sectors to the disk as a single
+   multi-sector transfer.  Delayed sectors are left alone.  Only
+   the slots of the run being written are locked, so hits on other
+   slots are not held up. */
+void cache_flush (void)
+{
+    size_t cnt = 0;
+    size_t i, j;
+
+    lock_acquire (&flush_lock);
+
+    /* Snapshot the dirty set.  Slots may be cleaned or recycled
+       before we get to them, so each one is rechecked once
+       locked. */
+    for (i = 0; i < cache_size; i++)
+        if (cache_slots[i].in_use && cache_slots[i].dirty
+            && !cache_is_delayed (cache_slots[i].sector_no))
+            flush_slots[cnt++] = &cache_slots[i];
+    sort (flush_slots, cnt, sizeof *flush_slots, flush_compare, NULL);
+
+    i = 0;
+    while (i < cnt) {
+        struct cache_entry *ce = flush_slots[i];
+        size_t first = i;
+        size_t run = 0;
+        disk_sector_t start;
+
+        lock_acquire (&ce->lock);
+        if (!ce->in_use || !ce->dirty || cache_is_delayed (ce->sector_no)) {
+            lock_release (&ce->lock);
+            i++;
+            continue;
+        }
+        start = ce->sector_no;
+        flush_buffers[run++] = ce->data;
+
+        /* Extend the run while the next slot holds the next
+           sector and is still dirty.  A slot that is busy, perhaps
+           pinned by a thread waiting on one already in the run,
+           ends the run instead of being waited for. */
+        for (i++; i < cnt && run < DISK_MULTIPLE_MAX; i++) {
+            ce = flush_slots[i];
+            if (ce->sector_no != start + run)
+                break;
+            if (!lock_try_acquire (&ce->lock))
+                break;
+            if (!ce->in_use || !ce->dirty || ce->sector_no != start + run) {
+                lock_release (&ce->lock);
+                break;
+            }
+            flush_buffers[run++] = ce->data;
+        }
+
+        disk_write_multiple (filesys_disk, start, run, flush_buffers);
+        lock_acquire(&cache_lock);
+        stats.write_back_batches++;
+        stats.write_back_sectors += run;
         lock_release(&cache_lock);
-        return length;
+        for (j = first; j < first + run; j++) {
+            cache_mark_clean(flush_slots[j]);
+            lock_release (&flush_slots[j]->lock);
+        }
     }
 
-    /* Cache miss */
-    // 1. Make a new cache_entry
-    struct cache_entry *new_entry = malloc(sizeof (struct cache_entry));
-    new_entry->sector_no = sector_idx;
-    new_entry->used = true;
-    new_entry->dirty = true;
-    new_entry->data = malloc(DISK_SECTOR_SIZE);
-    cache_insert(new_entry);
-
+    lock_release (&flush_lock);
+}
 
+/* Flushes the cache whenever write_back_sema is up'd, either by
+   write_back_timer, by dirty-slot pressure or by delayed sectors
+   piling up.  Delayed sectors are assigned disk sectors first,
+   and then the free map's dirty sectors are handed to the cache,
+   so that all of them go out in the same pass. */
+static void
+write_back_thread (void *aux UNUSED)
+{
+    while (true)
+    {
+        sema_down (&write_back_sema);
+        inode_flush_delayed (false);
+        free_map_flush ();
+        cache_flush ();
+    }
+}
 
+/* Starts a flush every 5 seconds. */
+static void
+write_back_timer (void *aux UNUSED)
+{
+    while (true)
+    {
+        timer_sleep(5*TIMER_FREQ);
+        sema_up (&write_back_sema);
+    }
+}
 
-    //2. Write to cache
-    if (partial)
-        disk_read(filesys_disk, sector_idx, new_entry->data);
-    else
-        memset(new_entry->data, 0, DISK_SECTOR_SIZE);
-        
-    memcpy(new_entry->data + sector_ofs, buffer, length);
+/* Copies LENGTH bytes from BUFFER into sector SECTOR_IDX at
+   SECTOR_OFS.  PARTIAL must be true unless the write covers the
+   whole sector, in which case a miss skips reading it in. */
+int write_to_cache(disk_sector_t sector_idx, int sector_ofs, void *buffer, int length, bool partial)
+{
+    struct cache_entry *ce = cache_acquire(sector_idx, partial, false);
+    memcpy(ce->data + sector_ofs, buffer, length);
+    cache_mark_dirty(ce);
+    lock_release (&ce->lock);
+    return length;
+}
 
+/* Copies the cache statistics into *S.  They are all updated
+   under cache_lock, so the copy is a consistent snapshot. */
+void cache_get_stats (struct cache_stats *s)
+{
+    lock_acquire(&cache_lock);
+    *s = stats;
     lock_release(&cache_lock);
-    return length;
 }
 
-//[TODO 5] update_write : Periodically update dirty blocks to the real disk- using timer_sleep() (Later)
+/* Prints buffer cache statistics. */
+void cache_print_stats (void)
+{
+    struct cache_stats s;
+
+    cache_get_stats (&s);
+    printf ("Buffer cache (%s): %lld hits, %lld misses, %lld evictions (%lld dirty)\n",
+            policy->name, s.hits, s.misses, s.evictions,
+            s.dirty_evictions);
+    printf ("Read-ahead: %lld issued, %lld used, %lld wasted\n",
+            s.read_ahead_issued, s.read_ahead_used,
+            s.read_ahead_wasted);
+    printf ("Write-back: %lld batches, %lld sectors\n",
+            s.write_back_batches, s.write_back_sectors);
+}
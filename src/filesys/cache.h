@@ -10,30 +10,86 @@
 #include "filesys/off_t.h"
 #include "devices/disk.h"
 #include <stdio.h>
-#include <hash.h>
+#include <list.h>
+#include <cache-stats.h>
 
+/* Default number of sectors held by the buffer cache. */
+#define CACHE_SIZE_DEFAULT 64
+
+/* Maximum number of consecutive sectors transferred as one run. */
+#define RUN_MAX 16
+
+/* Smallest buffer cache allowed: one that a run takes at most a
+   quarter of. */
+#define CACHE_SIZE_MIN (4 * RUN_MAX)
+
+/* Number of sectors held by the buffer cache.
+   Controlled by kernel command-line option "-cache=SECTORS". */
+extern size_t cache_size;
+
+/* Sector numbers from CACHE_DELAYED_BASE up, handed out by
+   cache_new_delayed(), name "delayed" sectors: file data that has
+   no place on disk yet and lives only in the cache until
+   cache_assign() moves it to a real sector.  Their slots are
+   never evicted or written back. */
+#define CACHE_DELAYED_BASE 0x80000000u
+
+/* Returns true if SECTOR_NO is a delayed sector. */
+static inline bool
+cache_is_delayed (disk_sector_t sector_no)
+{
+  return sector_no >= CACHE_DELAYED_BASE;
+}
+
+/* A buffer cache slot.
+   All slots are preallocated by cache_init() and recycled by the
+   replacement policy; they are never freed.
+
+   SECTOR_NO and IN_USE change only while both cache_lock and the
+   slot's LOCK are held, so either lock is enough to read them.
+   DATA and DIRTY belong to LOCK alone.  A slot whose sector is
+   being loaded or written back keeps LOCK held for the whole
+   transfer, so lookups of that sector wait on the slot while
+   hits on every other slot go ahead. */
 struct cache_entry
 {
-    struct hash_elem elem;
-    disk_sector_t sector_no;
-    bool used;
-    bool dirty;
-    void *data; //DISK_SECTOR_SIZE
+    struct list_elem elem;      /* Element in hash bucket. */
+    struct lock lock;           /* Guards DATA and DIRTY. */
+    disk_sector_t sector_no;    /* Cached sector, if in_use. */
+    bool in_use;                /* Holds a valid sector? */
+    struct list_elem policy_elem;   /* Element in a policy queue. */
+    struct list *queue;         /* Policy queue holding the slot. */
+    bool used;                  /* Reference bit for clock. */
+    bool dirty;                 /* Modified since read in? */
+    bool prefetched;            /* Loaded by read-ahead, not yet used? */
+    void *data;                 /* DISK_SECTOR_SIZE bytes. */
 };
 
-struct hash buffer_cache;
-struct lock cache_lock;
+bool cache_set_policy (const char *name);
+void cache_init (void);
+void cache_flush (void);
+void cache_get_stats (struct cache_stats *);
+void cache_print_stats (void);
 
-unsigned cache_hash(const struct hash_elem *p_, void *aux UNUSED);
-bool cache_less(const struct hash_elem *a_, const struct hash_elem *b_, void *aux UNUSED);
+void cache_read_ahead(disk_sector_t sector_no);
 
-void cache_init();
+void *cache_get(disk_sector_t sector_no);
+void *cache_get_blank(disk_sector_t sector_no);
+void cache_put(disk_sector_t sector_no, bool dirty);
+
+disk_sector_t cache_new_delayed(void);
+void cache_assign(disk_sector_t delayed, disk_sector_t sector_no);
+void cache_discard(disk_sector_t delayed);
+void cache_forget(disk_sector_t sector_no, size_t cnt);
 
 int read_in_cache(disk_sector_t sector_idx, int sector_ofs, void *buffer, int readsize);
 int write_to_cache(disk_sector_t sector_idx, int sector_ofs, void *buffer, int length, bool partial);
+void cache_read_run(disk_sector_t sector_idx, int sector_ofs, void *buffer,
+                    int size);
+void cache_write_run(disk_sector_t sector_idx, int sector_ofs,
+                     const void *buffer, int size);
 
 
 
 
 #endif /* filesys/cache.h */
-
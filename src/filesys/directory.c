@@ -1,10 +1,15 @@
 #include "filesys/directory.h"
+#include <debug.h>
+#include <stddef.h>
 #include <stdio.h>
 #include <string.h>
+#include <hash.h>
 #include <list.h>
+#include <round.h>
 #include "filesys/filesys.h"
 #include "filesys/inode.h"
 #include "threads/malloc.h"
+#include "threads/synch.h"
 #include "filesys/cache.h"
 
 /* A directory. */
@@ -23,12 +28,247 @@
 //    bool in_use;                        /* In use or free? */
 //  };
 
+/* Dentry cache.
+
+   Caches the results of name lookups, keyed by the sector of the
+   directory searched and the name, so that resolving a path whose
+   components were resolved recently reads no directory data.  A
+   name found to be absent is cached too, as a negative entry.
+   dir_add() and dir_remove() keep the cache in step with the
+   directories, and the least recently used entries are dropped
+   once DCACHE_MAX are cached. */
+
+/* Maximum number of cached entries. */
+#define DCACHE_MAX 256
+
+/* A cached lookup result. */
+struct dentry
+  {
+    struct hash_elem hash_elem;         /* Element in dcache. */
+    struct list_elem lru_elem;          /* Element in dcache_lru. */
+    disk_sector_t parent;               /* Sector of directory. */
+    disk_sector_t sector;               /* Sector of NAME's inode, or 0. */
+    char name[NAME_MAX + 1];            /* Null terminated file name. */
+  };
+
+static struct hash dcache;              /* All cached entries. */
+static struct list dcache_lru;          /* Entries, most recently used first. */
+static struct lock dcache_lock;         /* Protects the above. */
+
+/* Incremented by every change to a directory, so that a lookup
+   can tell whether what it read is still current before caching
+   it. */
+static unsigned dcache_gen;
+
+/* Returns a hash value for dentry E. */
+static unsigned
+dentry_hash (const struct hash_elem *e, void *aux UNUSED)
+{
+  const struct dentry *d = hash_entry (e, struct dentry, hash_elem);
+  return hash_string (d->name) ^ hash_int (d->parent);
+}
+
+/* Returns true if dentry A precedes dentry B. */
+static bool
+dentry_less (const struct hash_elem *a_, const struct hash_elem *b_,
+             void *aux UNUSED)
+{
+  const struct dentry *a = hash_entry (a_, struct dentry, hash_elem);
+  const struct dentry *b = hash_entry (b_, struct dentry, hash_elem);
+
+  if (a->parent != b->parent)
+    return a->parent < b->parent;
+  return strcmp (a->name, b->name) < 0;
+}
+
+/* Initializes the directory module. */
+void
+dir_init (void) 
+{
+  hash_init (&dcache, dentry_hash, dentry_less, NULL);
+  list_init (&dcache_lru);
+  lock_init (&dcache_lock);
+}
+
+/* Returns the cached entry for NAME in the directory in sector
+   PARENT, or a null pointer if there is none.
+   Must be called with dcache_lock held. */
+static struct dentry *
+dcache_find (disk_sector_t parent, const char *name)
+{
+  struct dentry key;
+  struct hash_elem *e;
+
+  key.parent = parent;
+  strlcpy (key.name, name, sizeof key.name);
+  e = hash_find (&dcache, &key.hash_elem);
+  return e != NULL ? hash_entry (e, struct dentry, hash_elem) : NULL;
+}
+
+/* Looks up NAME in the directory in sector PARENT.  On a hit,
+   stores the sector of its inode, or 0 if NAME is known not to
+   exist, into *SECTORP and returns true.  Returns false on a
+   miss. */
+static bool
+dcache_lookup (disk_sector_t parent, const char *name,
+               disk_sector_t *sectorp)
+{
+  struct dentry *d;
+
+  lock_acquire (&dcache_lock);
+  d = dcache_find (parent, name);
+  if (d != NULL) 
+    {
+      list_remove (&d->lru_elem);
+      list_push_front (&dcache_lru, &d->lru_elem);
+      *sectorp = d->sector;
+    }
+  lock_release (&dcache_lock);
+  return d != NULL;
+}
+
+/* Caches SECTOR, or 0 for a negative entry, as the result of
+   looking up NAME in directory DIR.  If GEN is not dcache_gen,
+   DIR may have changed since the lookup, and nothing is cached.
+   Nothing is cached for a removed directory either, whose sector
+   may be reused. */
+static void
+dcache_insert (const struct dir *dir, const char *name,
+               disk_sector_t sector, unsigned gen)
+{
+  disk_sector_t parent = dir->inode->sector;
+  struct dentry *d;
+
+  if (strlen (name) > NAME_MAX)
+    return;
+
+  lock_acquire (&dcache_lock);
+  if (gen != dcache_gen || dir->inode->removed)
+    goto done;
+
+  d = dcache_find (parent, name);
+  if (d != NULL)
+    list_remove (&d->lru_elem);
+  else 
+    {
+      if (hash_size (&dcache) >= DCACHE_MAX) 
+        {
+          d = list_entry (list_pop_back (&dcache_lru),
+                          struct dentry, lru_elem);
+          hash_delete (&dcache, &d->hash_elem);
+        }
+      else 
+        {
+          d = malloc (sizeof *d);
+          if (d == NULL)
+            goto done;
+        }
+      d->parent = parent;
+      strlcpy (d->name, name, sizeof d->name);
+      hash_insert (&dcache, &d->hash_elem);
+    }
+  d->sector = sector;
+  list_push_front (&dcache_lru, &d->lru_elem);
+
+ done:
+  lock_release (&dcache_lock);
+}
+
+/* Notes that the entry for NAME in DIR now refers to SECTOR, or
+   to nothing if SECTOR is 0, and caches that. */
+static void
+dcache_update (const struct dir *dir, const char *name,
+               disk_sector_t sector)
+{
+  unsigned gen;
+
+  lock_acquire (&dcache_lock);
+  gen = ++dcache_gen;
+  lock_release (&dcache_lock);
+  dcache_insert (dir, name, sector, gen);
+}
+
+/* Drops every cached entry for the directory in sector PARENT. */
+static void
+dcache_purge (disk_sector_t parent)
+{
+  struct list_elem *e, *next;
+
+  lock_acquire (&dcache_lock);
+  dcache_gen++;
+  for (e = list_begin (&dcache_lru); e != list_end (&dcache_lru); e = next) 
+    {
+      struct dentry *d = list_entry (e, struct dentry, lru_elem);
+      next = list_next (e);
+      if (d->parent == parent) 
+        {
+          list_remove (&d->lru_elem);
+          hash_delete (&dcache, &d->hash_elem);
+          free (d);
+        }
+    }
+  lock_release (&dcache_lock);
+}
+
+/* Hashed directories.
+
+   A directory made by dir_create() is hashed: its data is an array
+   of buckets, one per sector, and a power of 2 of them.  The entry
+   for a name is kept in the bucket the name hashes to, or in one
+   of the DIR_PROBE_MAX - 1 buckets after it, wrapping around.
+   Every full bucket passed over on the way is marked as having
+   overflowed, so a lookup reads buckets only until it finds one
+   that has not.  A directory with no room left for a name is
+   rehashed into twice as many buckets.  Either way a name costs a
+   bounded number of sector reads, however large the directory.
+
+   Directories from before this format have dir_hashed clear.  They
+   are still searched and extended linearly. */
+
+/* Entries per bucket. */
+#define BUCKET_ENTRIES (DISK_SECTOR_SIZE / sizeof (struct dir_entry))
+
+/* Number of buckets that may hold a given name. */
+#define DIR_PROBE_MAX 4
+
+/* A bucket of a hashed directory, occupying one sector. */
+struct dir_bucket
+  {
+    struct dir_entry entries[BUCKET_ENTRIES];
+    bool overflow;              /* Entries placed past this bucket? */
+  };
+
+/* Returns true if DIR is hashed. */
+static bool
+dir_is_hashed (const struct dir *dir)
+{
+  return dir->inode->data.dir_hashed;
+}
+
+/* Returns the number of buckets in hashed directory DIR: the
+   largest power of 2 that fits in its length.  Sectors past that,
+   left over from a failed rehash, are not part of the table. */
+static size_t
+bucket_count (const struct dir *dir)
+{
+  size_t sectors = inode_length (dir->inode) / DISK_SECTOR_SIZE;
+  size_t cnt = 1;
+
+  while (cnt * 2 <= sectors)
+    cnt *= 2;
+  return cnt;
+}
+
 /* Creates a directory with space for ENTRY_CNT entries in the
    given SECTOR.  Returns true if successful, false on failure. */
 bool
 dir_create (disk_sector_t sector, size_t entry_cnt) 
 {
-  return inode_create (sector, entry_cnt * sizeof (struct dir_entry), true);
+  size_t bucket_cnt = 1;
+
+  while (bucket_cnt * BUCKET_ENTRIES < entry_cnt)
+    bucket_cnt *= 2;
+  return inode_create (sector, bucket_cnt * DISK_SECTOR_SIZE, true);
 }
 
 /* Opens and returns the directory for the given INODE, of which
@@ -85,38 +325,294 @@ dir_get_inode (struct dir *dir)
   return dir->inode;
 }
 
-/* Searches DIR for a file with the given NAME.
-   If successful, returns true, sets *EP to the directory entry
-   if EP is non-null, and sets *OFSP to the byte offset of the
-   directory entry if OFSP is non-null.
-   otherwise, returns false and ignores EP and OFSP. */
+/* Searches linear directory DIR as lookup() does. */
 static bool
-lookup (const struct dir *dir, const char *name,
-        struct dir_entry *ep, off_t *ofsp) 
+linear_lookup (const struct dir *dir, const char *name,
+               struct dir_entry *ep, off_t *ofsp) 
 {
+  static const struct dir_entry hole_entry;  /* Entries in holes. */
+  off_t length = inode_length (dir->inode);
+  disk_sector_t sector = 0;         /* Sector at DATA_OFS, 0 if a hole. */
+  const uint8_t *data = NULL;       /* SECTOR pinned, if not a hole. */
+  off_t data_ofs = -1;              /* Byte offset of SECTOR in DIR. */
   struct dir_entry e;
-  size_t ofs;
+  bool found = false;
+  off_t ofs;
   
   ASSERT (dir != NULL);
   ASSERT (name != NULL);
 
  // printf("find %s\n", name);
 
-  for (ofs = 0; inode_read_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
-       ofs += sizeof e) {      
-    if (e.in_use && !strcmp (name, e.name)) 
+  /* Entries are compared in place in the buffer cache.  The few
+     that straddle a sector boundary are copied out instead. */
+  for (ofs = 0; ofs + (off_t) sizeof e <= length; ofs += sizeof e) {
+    off_t sector_ofs = ofs % DISK_SECTOR_SIZE;
+    const struct dir_entry *p;
+
+    if (sector_ofs + sizeof e > DISK_SECTOR_SIZE) {
+        if (data != NULL) {
+            cache_put (sector, false);
+            data = NULL;
+            data_ofs = -1;
+        }
+        if (inode_read_at (dir->inode, &e, sizeof e, ofs) != sizeof e)
+          break;
+        p = &e;
+    }
+    else {
+        if (data_ofs != ofs - sector_ofs) {
+            if (data != NULL)
+              cache_put (sector, false);
+            sector = byte_to_sector_indexed (dir->inode, ofs, length);
+            data = sector != 0 ? cache_get (sector) : NULL;
+            data_ofs = ofs - sector_ofs;
+        }
+        p = data != NULL ? (const struct dir_entry *) (data + sector_ofs)
+                         : &hole_entry;
+    }
+
+    if (p->in_use && !strcmp (name, p->name)) 
       {
-         // printf("directory lookup match %s %s\n", e.name);
+         // printf("directory lookup match %s %s\n", p->name);
         if (ep != NULL)
-          *ep = e;
+          *ep = *p;
         if (ofsp != NULL)
           *ofsp = ofs;
-        return true;
+        found = true;
+        break;
       }
   }
+  if (data != NULL)
+    cache_put (sector, false);
+  return found;
+}
+
+/* Searches hashed directory DIR as lookup() does. */
+static bool
+hashed_lookup (const struct dir *dir, const char *name,
+               struct dir_entry *ep, off_t *ofsp) 
+{
+  bool held = rwlock_held_for_write (&dir->inode->rwlock);
+  bool found = false;
+  off_t length;
+  size_t bucket_cnt, probes, b;
+  size_t i, j;
+
+  /* Buckets are read in place, so keep hashed_grow() from
+     resizing the table or emptying them under us, unless we are
+     the one changing DIR. */
+  if (!held)
+    rwlock_acquire_read (&dir->inode->rwlock);
+  length = inode_length (dir->inode);
+  bucket_cnt = bucket_count (dir);
+  probes = bucket_cnt < DIR_PROBE_MAX ? bucket_cnt : DIR_PROBE_MAX;
+  b = hash_string (name) & (bucket_cnt - 1);
+  for (i = 0; i < probes; i++, b = (b + 1) & (bucket_cnt - 1)) 
+    {
+      off_t ofs = (off_t) b * DISK_SECTOR_SIZE;
+      disk_sector_t sector = byte_to_sector_indexed (dir->inode, ofs, length);
+      const struct dir_bucket *bucket;
+      bool overflow;
+
+      /* A hole is an empty bucket. */
+      if (sector == 0)
+        break;
+
+      bucket = cache_get (sector);
+      for (j = 0; j < BUCKET_ENTRIES; j++) 
+        {
+          const struct dir_entry *p = &bucket->entries[j];
+          if (p->in_use && !strcmp (name, p->name)) 
+            {
+              if (ep != NULL)
+                *ep = *p;
+              if (ofsp != NULL)
+                *ofsp = ofs + j * sizeof *p;
+              found = true;
+              break;
+            }
+        }
+      overflow = bucket->overflow;
+      cache_put (sector, false);
+
+      if (found || !overflow)
+        break;
+    }
+  if (!held)
+    rwlock_release_read (&dir->inode->rwlock);
+  return found;
+}
+
+/* Searches DIR for a file with the given NAME.
+   If successful, returns true, sets *EP to the directory entry
+   if EP is non-null, and sets *OFSP to the byte offset of the
+   directory entry if OFSP is non-null.
+   otherwise, returns false and ignores EP and OFSP. */
+static bool
+lookup (const struct dir *dir, const char *name,
+        struct dir_entry *ep, off_t *ofsp) 
+{
+  if (dir_is_hashed (dir))
+    return hashed_lookup (dir, name, ep, ofsp);
+  else
+    return linear_lookup (dir, name, ep, ofsp);
+}
+
+/* Tries to add E to hashed directory DIR, in the first free slot
+   among the buckets its name may go in.  Returns true if
+   successful.  Otherwise sets *FULLP to true if all of those
+   buckets are full, or to false if a disk error occurred. */
+static bool
+hashed_insert (struct dir *dir, const struct dir_entry *e, bool *fullp)
+{
+  static const bool overflow = true;
+  off_t length = inode_length (dir->inode);
+  size_t bucket_cnt = bucket_count (dir);
+  size_t probes = bucket_cnt < DIR_PROBE_MAX ? bucket_cnt : DIR_PROBE_MAX;
+  size_t b = hash_string (e->name) & (bucket_cnt - 1);
+  size_t i, j;
+
+  *fullp = false;
+  for (i = 0; i < probes; i++, b = (b + 1) & (bucket_cnt - 1)) 
+    {
+      off_t ofs = (off_t) b * DISK_SECTOR_SIZE;
+      disk_sector_t sector = byte_to_sector_indexed (dir->inode, ofs, length);
+      bool marked = true;
+
+      /* Find a free slot.  A hole is an empty bucket. */
+      j = 0;
+      if (sector != 0) 
+        {
+          const struct dir_bucket *bucket = cache_get (sector);
+          while (j < BUCKET_ENTRIES && bucket->entries[j].in_use)
+            j++;
+          marked = bucket->overflow;
+          cache_put (sector, false);
+        }
+
+      if (j < BUCKET_ENTRIES)
+        return inode_write_at (dir->inode, e, sizeof *e,
+                               ofs + j * sizeof *e) == sizeof *e;
+      if (!marked
+          && inode_write_at (dir->inode, &overflow, sizeof overflow,
+                             ofs + offsetof (struct dir_bucket, overflow))
+             != sizeof overflow)
+        return false;
+    }
+  *fullp = true;
+  return false;
+}
+
+/* Places E in the first free slot among the buckets its name may
+   go in within TABLE, an in-memory image of BUCKET_CNT buckets,
+   marking the full buckets passed over as having overflowed, as
+   hashed_insert() does on disk.  Returns false if all of those
+   buckets are full. */
+static bool
+bucket_place (uint8_t *table, size_t bucket_cnt, const struct dir_entry *e)
+{
+  size_t probes = bucket_cnt < DIR_PROBE_MAX ? bucket_cnt : DIR_PROBE_MAX;
+  size_t b = hash_string (e->name) & (bucket_cnt - 1);
+  size_t i, j;
+
+  for (i = 0; i < probes; i++, b = (b + 1) & (bucket_cnt - 1)) 
+    {
+      struct dir_bucket *bucket
+        = (struct dir_bucket *) (table + b * DISK_SECTOR_SIZE);
+
+      for (j = 0; j < BUCKET_ENTRIES; j++)
+        if (!bucket->entries[j].in_use) 
+          {
+            bucket->entries[j] = *e;
+            return true;
+          }
+      bucket->overflow = true;
+    }
   return false;
 }
 
+/* Rehashes hashed directory DIR into twice as many buckets.
+   DIR's rwlock must be held for writing.
+   Returns true if successful.  Fails, leaving DIR as it was, if
+   memory or disk space runs out, or in the unlikely case that the
+   entries of some name's buckets do not all fit in its new ones. */
+static bool
+hashed_grow (struct dir *dir)
+{
+  static const uint8_t zeros[DISK_SECTOR_SIZE];
+  struct inode *inode = dir->inode;
+  size_t bucket_cnt = bucket_count (dir);
+  size_t new_cnt = 2 * bucket_cnt;
+  uint8_t *table;
+  size_t b, i;
+
+  ASSERT (rwlock_held_for_write (&inode->rwlock));
+
+  /* Build the new table in memory, so that nothing on disk changes
+     until every step that can fail is behind us. */
+  table = calloc (new_cnt, DISK_SECTOR_SIZE);
+  if (table == NULL)
+    return false;
+  for (b = 0; b < bucket_cnt; b++) 
+    {
+      off_t ofs = (off_t) b * DISK_SECTOR_SIZE;
+      disk_sector_t sector = byte_to_sector_indexed (inode, ofs,
+                                                     inode_length (inode));
+      const struct dir_bucket *bucket;
+      bool fits = true;
+
+      if (sector == 0)
+        continue;               /* A hole is an empty bucket. */
+      bucket = cache_get (sector);
+      for (i = 0; i < BUCKET_ENTRIES && fits; i++)
+        if (bucket->entries[i].in_use)
+          fits = bucket_place (table, new_cnt, &bucket->entries[i]);
+      cache_put (sector, false);
+      if (!fits) 
+        {
+          free (table);
+          return false;
+        }
+    }
+
+  /* Give every bucket of the new table a sector, so that writing
+     it out cannot run out of space.  The new buckets are added in
+     order; if the disk fills up partway, the table stays at its
+     old size, which is the largest power of 2 that fits. */
+  for (b = 0; b < new_cnt; b++) 
+    {
+      off_t ofs = (off_t) b * DISK_SECTOR_SIZE;
+      if ((ofs >= inode_length (inode)
+           || byte_to_sector_indexed (inode, ofs, inode_length (inode)) == 0)
+          && inode_write_at (inode, zeros, DISK_SECTOR_SIZE, ofs)
+             != DISK_SECTOR_SIZE)
+        {
+          free (table);
+          return false;
+        }
+    }
+
+  /* Write it out over the old one.  A lookup that read the old
+     table must not cache what it found once the buckets start to
+     change. */
+  lock_acquire (&dcache_lock);
+  dcache_gen++;
+  lock_release (&dcache_lock);
+  for (b = 0; b < new_cnt; b++) 
+    {
+      off_t ofs = (off_t) b * DISK_SECTOR_SIZE;
+      disk_sector_t sector = byte_to_sector_indexed (inode, ofs,
+                                                     inode_length (inode));
+
+      memcpy (cache_get_blank (sector), table + b * DISK_SECTOR_SIZE,
+              DISK_SECTOR_SIZE);
+      cache_put (sector, true);
+    }
+  free (table);
+  return true;
+}
+
 /* Searches DIR for a file with the given NAME
    and returns true if one exists, false otherwise.
    On success, sets *INODE to an inode for the file, otherwise to
@@ -126,31 +622,48 @@ dir_lookup (const struct dir *dir, const char *name,
             struct inode **inode) 
 {
   struct dir_entry e;
+  disk_sector_t sector;
 
   ASSERT (dir != NULL);
   ASSERT (name != NULL);
 
   //printf("lookup directory %d to find %s\n", dir->inode->sector, name);
 
-  if (lookup (dir, name, &e, NULL)) {
-      //printf("lookup ok\n");
-    *inode = inode_open (e.inode_sector);
-  }
-  else
-    *inode = NULL;
+  if (dcache_lookup (dir->inode->sector, name, &sector))
+    *inode = sector != 0 ? inode_open (sector) : NULL;
+  else 
+    {
+      unsigned gen = dcache_gen;
+
+      if (lookup (dir, name, &e, NULL)) {
+          //printf("lookup ok\n");
+        dcache_insert (dir, name, e.inode_sector, gen);
+        *inode = inode_open (e.inode_sector);
+      }
+      else {
+        dcache_insert (dir, name, 0, gen);
+        *inode = NULL;
+      }
+    }
 
   return *inode != NULL;
 }
 
 /* Adds a file named NAME to DIR, which must not already contain a
    file by that name.  The file's inode is in sector
-   INODE_SECTOR.
+   INODE_SECTOR, and IS_DIR tells whether it is a directory, which
+   the entry records so that listing DIR need not open it.
    Returns true if successful, false on failure.
    Fails if NAME is invalid (i.e. too long) or a disk or memory
-   error occurs. */
+   error occurs.
+
+   Adding and removing entries hold DIR's rwlock for writing
+   throughout, so that a rehash by hashed_grow() never runs
+   alongside another change to DIR. */
 
 bool
-dir_add_relative (struct dir *dir, const char *name, disk_sector_t inode_sector) 
+dir_add_relative (struct dir *dir, const char *name, disk_sector_t inode_sector,
+                  bool is_dir) 
 {
   struct dir_entry e;
   off_t ofs;
@@ -163,7 +676,12 @@ dir_add_relative (struct dir *dir, const char *name, disk_sector_t inode_sector)
   if (*name == '\0' || strlen (name) > NAME_MAX)
     return false;
 
+  /* Hashed directories place entries by name. */
+  if (dir_is_hashed (dir))
+    return dir_add (dir, name, inode_sector, is_dir);
+
   /* Check that NAME is not in use. */
+  rwlock_acquire_write (&dir->inode->rwlock);
   if (lookup (dir, name, NULL, NULL))
     goto done;
 
@@ -181,18 +699,24 @@ dir_add_relative (struct dir *dir, const char *name, disk_sector_t inode_sector)
 
   /* Write slot. */
   e.in_use = true;
+  e.is_dir = is_dir;
   strlcpy (e.name, name, sizeof e.name);
   e.inode_sector = inode_sector;
   success = inode_write_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
+  if (success)
+    dcache_update (dir, name, inode_sector);
 
  done:
+  rwlock_release_write (&dir->inode->rwlock);
   return success;
 }
 
 bool
-dir_add (struct dir *dir, const char *name, disk_sector_t inode_sector) 
+dir_add (struct dir *dir, const char *name, disk_sector_t inode_sector,
+         bool is_dir) 
 {
   struct dir_entry e;
+  disk_sector_t cached;
   off_t ofs;
   bool success = false;
   
@@ -204,9 +728,26 @@ dir_add (struct dir *dir, const char *name, disk_sector_t inode_sector)
     return false;
 
   /* Check that NAME is not in use. */
-  if (lookup (dir, name, NULL, NULL))
+  rwlock_acquire_write (&dir->inode->rwlock);
+  if (dcache_lookup (dir->inode->sector, name, &cached)
+      ? cached != 0 : lookup (dir, name, NULL, NULL))
     goto done;
 
+  if (dir_is_hashed (dir)) 
+    {
+      bool full;
+
+      memset (&e, 0, sizeof e);
+      e.in_use = true;
+      e.is_dir = is_dir;
+      strlcpy (e.name, name, sizeof e.name);
+      e.inode_sector = inode_sector;
+      while (!(success = hashed_insert (dir, &e, &full)))
+        if (!full || !hashed_grow (dir))
+          break;
+      goto done;
+    }
+
   /* Set OFS to offset of free slot.
      If there are no free slots, then it will be set to the
      current end-of-file.
@@ -221,12 +762,16 @@ dir_add (struct dir *dir, const char *name, disk_sector_t inode_sector)
 
   /* Write slot. */
   e.in_use = true;
+  e.is_dir = is_dir;
   strlcpy (e.name, name, sizeof e.name);
   e.inode_sector = inode_sector;
   //printf("add %s[%d] to directory %d\n", e.name, inode_sector, dir->inode->sector);
   success = inode_write_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
 
 done:
+  if (success)
+    dcache_update (dir, name, inode_sector);
+  rwlock_release_write (&dir->inode->rwlock);
   return success;
 }
 
@@ -245,6 +790,7 @@ dir_remove (struct dir *dir, const char *name)
   ASSERT (name != NULL);
 
   /* Find directory entry. */
+  rwlock_acquire_write (&dir->inode->rwlock);
   if (!lookup (dir, name, &e, &ofs))
     goto done;
 
@@ -259,16 +805,104 @@ dir_remove (struct dir *dir, const char *name)
     goto done;
  // printf("e is not in use\n");
 
-  /* Remove inode. */
+  /* Remove inode.  Its sector may be reused, so forget any names
+     cached under it if it is a directory.  Marking it removed
+     first keeps a lookup still running in it from caching a name
+     again after the purge. */
+  dcache_update (dir, name, 0);
   inode_remove (inode);
+  if (inode->data.is_dir)
+    dcache_purge (e.inode_sector);
   //printf("inode removed\n");
   success = true;
 
  done:
+  rwlock_release_write (&dir->inode->rwlock);
   inode_close (inode);
   return success;
 }
 
+/* Reads the directory entry at byte offset *OFSP in DIR, or the
+   first one after it, into *E and advances *OFSP past it.  Returns
+   false at the end of DIR.  In a hashed directory, the tail of
+   each bucket holds no entries and is skipped. */
+static bool
+read_entry (const struct dir *dir, off_t *ofsp, struct dir_entry *e)
+{
+  if (dir_is_hashed (dir)
+      && *ofsp % DISK_SECTOR_SIZE > (off_t) ((BUCKET_ENTRIES - 1) * sizeof *e))
+    *ofsp = ROUND_UP (*ofsp, DISK_SECTOR_SIZE);
+  if (inode_read_at (dir->inode, e, sizeof *e, *ofsp) != sizeof *e)
+    return false;
+  *ofsp += sizeof *e;
+  return true;
+}
+
+/* Returns true if DIR has no entries. */
+bool
+dir_is_empty (const struct dir *dir)
+{
+  struct dir_entry e;
+  off_t ofs = 0;
+
+  while (read_entry (dir, &ofs, &e))
+    if (e.in_use)
+      return false;
+  return true;
+}
+
+/* Reads up to CNT of the next entries in DIR into ENTRIES, with
+   the inode number and type of each as recorded in its entry, so
+   that no inode is opened.  Reads as many entries at a time as
+   fit in a bucket, so a whole bucket of a hashed directory takes
+   one inode_read_at().  Returns the number of entries read, 0 at
+   the end of DIR. */
+size_t
+dir_read_entries (struct dir *dir, struct dirent *entries, size_t cnt)
+{
+  struct dir_entry chunk[BUCKET_ENTRIES];
+  size_t n = 0;
+
+  while (n < cnt)
+    {
+      off_t ofs = dir->pos;
+      size_t chunk_cnt = BUCKET_ENTRIES;
+      size_t i;
+
+      /* Stay within the current bucket of a hashed directory. */
+      if (dir_is_hashed (dir)) 
+        {
+          size_t slot = ofs % DISK_SECTOR_SIZE / sizeof *chunk;
+          if (slot >= BUCKET_ENTRIES) 
+            {
+              ofs = ROUND_UP (ofs, DISK_SECTOR_SIZE);
+              slot = 0;
+            }
+          chunk_cnt = BUCKET_ENTRIES - slot;
+        }
+
+      chunk_cnt = inode_read_at (dir->inode, chunk, chunk_cnt * sizeof *chunk,
+                                 ofs) / sizeof *chunk;
+      if (chunk_cnt == 0)
+        break;
+
+      for (i = 0; i < chunk_cnt && n < cnt; i++) 
+        {
+          ofs += sizeof *chunk;
+          if (chunk[i].in_use) 
+            {
+              struct dirent *d = &entries[n++];
+
+              d->inumber = chunk[i].inode_sector;
+              d->is_dir = chunk[i].is_dir;
+              strlcpy (d->name, chunk[i].name, sizeof d->name);
+            }
+        }
+      dir->pos = ofs;
+    }
+  return n;
+}
+
 /* Reads the next directory entry in DIR and stores the name in
    NAME.  Returns true if successful, false if the directory
    contains no more entries. */
@@ -276,12 +910,13 @@ bool
 dir_readdir (struct dir *dir, char name[NAME_MAX + 1])
 {
   struct dir_entry e;
+  off_t pos = dir->pos;
 
   //printf("dir_readdir\n");
-  while (inode_read_at (dir->inode, &e, sizeof e, dir->pos) == sizeof e) 
+  while (read_entry (dir, &pos, &e)) 
     {
         //printf("%s\n", e.name);
-      dir->pos += sizeof e;
+      dir->pos = pos;
       if (e.in_use)
         {
           strlcpy (name, e.name, NAME_MAX + 1);
@@ -3,6 +3,7 @@
 
 #include <stdbool.h>
 #include <stddef.h>
+#include <dirent.h>
 #include "devices/disk.h"
 
 /* Maximum length of a file name component.
@@ -23,10 +24,13 @@ struct dir_entry
 	disk_sector_t inode_sector;
 	char name[NAME_MAX + 1];
 	bool in_use;
+	bool is_dir;                    /* Does INODE_SECTOR hold a directory? */
 };
 
 struct inode;
 
+void dir_init (void);
+
 /* Opening and closing directories. */
 bool dir_create (disk_sector_t sector, size_t entry_cnt);
 struct dir *dir_open (struct inode *);
@@ -37,8 +41,10 @@ struct inode *dir_get_inode (struct dir *);
 
 /* Reading and writing. */
 bool dir_lookup (const struct dir *, const char *name, struct inode **);
-bool dir_add (struct dir *, const char *name, disk_sector_t);
+bool dir_add (struct dir *, const char *name, disk_sector_t, bool is_dir);
 bool dir_remove (struct dir *, const char *name);
 bool dir_readdir (struct dir *, char name[NAME_MAX + 1]);
+size_t dir_read_entries (struct dir *, struct dirent *, size_t cnt);
+bool dir_is_empty (const struct dir *);
 
 #endif /* filesys/directory.h */
@@ -2,6 +2,10 @@
 #include <debug.h>
 #include "filesys/inode.h"
 #include "threads/malloc.h"
+#include "devices/disk.h"
+
+/* Largest read-ahead window, in sectors. */
+#define READ_AHEAD_WINDOW_MAX 8
 
 /* An open file. */
 //struct file 
@@ -23,6 +27,9 @@ file_open (struct inode *inode)
       file->inode = inode;
       file->pos = 0;
       file->deny_write = false;
+      file->ra_next = 0;
+      file->ra_end = 0;
+      file->ra_window = 0;
       return file;
     }
   else
@@ -60,6 +67,44 @@ file_get_inode (struct file *file)
   return file->inode;
 }
 
+/* Updates FILE's read-ahead state after a read of BYTES_READ
+   bytes at OFFSET.  A read that starts where the previous one
+   ended doubles the window, up to READ_AHEAD_WINDOW_MAX sectors;
+   any other read halves it.  Sectors within the window past the
+   end of the read that have not been requested yet are queued,
+   as far as inode_read_ahead() can map them without waiting. */
+static void
+file_read_ahead (struct file *file, off_t offset, off_t bytes_read)
+{
+  off_t end = offset + bytes_read;
+  off_t window_end;
+
+  if (offset == file->ra_next)
+    {
+      if (file->ra_window == 0)
+        file->ra_window = 1;
+      else if (file->ra_window < READ_AHEAD_WINDOW_MAX)
+        file->ra_window *= 2;
+    }
+  else
+    {
+      file->ra_window /= 2;
+      file->ra_end = end;
+    }
+  file->ra_next = end;
+
+  if (file->ra_window == 0)
+    return;
+  if (file->ra_end < end)
+    file->ra_end = end;
+  window_end = end + file->ra_window * DISK_SECTOR_SIZE;
+  if (file->ra_end < window_end)
+    {
+      file->ra_end += inode_read_ahead (file->inode, file->ra_end,
+                                        window_end - file->ra_end);
+    }
+}
+
 /* Reads SIZE bytes from FILE into BUFFER,
    starting at the file's current position.
    Returns the number of bytes actually read,
@@ -70,6 +115,7 @@ file_read (struct file *file, void *buffer, off_t size)
 {
     //printf("in file_read\n");
   off_t bytes_read = inode_read_at (file->inode, buffer, size, file->pos);
+  file_read_ahead (file, file->pos, bytes_read);
   file->pos += bytes_read;
   return bytes_read;
 }
@@ -82,7 +128,9 @@ file_read (struct file *file, void *buffer, off_t size)
 off_t
 file_read_at (struct file *file, void *buffer, off_t size, off_t file_ofs) 
 {
-  return inode_read_at (file->inode, buffer, size, file_ofs);
+  off_t bytes_read = inode_read_at (file->inode, buffer, size, file_ofs);
+  file_read_ahead (file, file_ofs, bytes_read);
+  return bytes_read;
 }
 
 /* Writes SIZE bytes from BUFFER into FILE,
@@ -9,6 +9,11 @@ struct file
 	struct inode* inode;
 	off_t pos;
 	bool deny_write;
+
+	/* Sequential read detection, for read-ahead. */
+	off_t ra_next;          /* Offset a sequential read would start at. */
+	off_t ra_end;           /* End of the range already queued. */
+	int ra_window;          /* Current read-ahead window, in sectors. */
 };
 
 struct inode;
@@ -26,6 +26,7 @@ filesys_init (bool format)
 
   lock_init(&disk_lock);
   inode_init ();
+  dir_init ();
   free_map_init ();
   cache_init ();
 
@@ -41,22 +42,17 @@ filesys_init (bool format)
 void
 filesys_done (void) 
 {
-    /* write back cache */
-    lock_acquire(&cache_lock);
-    struct hash_iterator i;
-    hash_first (&i, &buffer_cache);
-    while (hash_next(&i))
-    {
-        struct cache_entry *ce = hash_entry (hash_cur(&i), struct cache_entry, elem);
-        if (ce->dirty == true) {
-            disk_write(filesys_disk, ce->sector_no, ce->data);
-        }
-    }
-    lock_release(&cache_lock);
-
-
+    /* Delayed sectors need their place in the free map, and the
+       free map is written through the cache, so assign them, then
+       close the free map, before writing back the cache.  Busy
+       inodes are waited for, not skipped, since no later pass
+       would pick them up. */
+    inode_flush_delayed (true);
     free_map_close ();
 
+    /* write back cache */
+    cache_flush ();
+
 }
 
 /* Creates a file named NAME with the given INITIAL_SIZE.
@@ -78,7 +74,7 @@ filesys_create (const char *name, off_t initial_size, struct dir *file_dir)
   bool success = (dir != NULL
                   && (free_map_success = free_map_allocate (1, &inode_sector))
                   && (inode_create_success = inode_create (inode_sector, initial_size, false))
-                  && (dir_add_success = dir_add (dir, name, inode_sector)));
+                  && (dir_add_success = dir_add (dir, name, inode_sector, false)));
   if (!success && inode_sector != 0) 
     free_map_release (inode_sector, 1);
   dir_close (dir);
@@ -144,6 +140,107 @@ filesys_remove (const char *name, struct dir *file_dir)
   return success;
 }
 
+/* Copies the path component that starts at or after *PATHP into
+   NAME and advances *PATHP past it.  Returns 1 if a component was
+   copied, 0 at the end of the path, or -1 if the component is
+   longer than NAME_MAX. */
+static int
+next_component (const char **pathp, char name[NAME_MAX + 1])
+{
+  const char *p = *pathp;
+  size_t len = 0;
+
+  while (*p == '/')
+    p++;
+  if (*p == '\0')
+    return 0;
+  for (; *p != '/' && *p != '\0'; p++)
+    {
+      if (len >= NAME_MAX)
+        return -1;
+      name[len++] = *p;
+    }
+  name[len] = '\0';
+  *pathp = p;
+  return 1;
+}
+
+/* Opens the inode that NAME refers to in DIR, handling "." and
+   ".." through DIR's own and parent sectors.  Returns a null
+   pointer if there is none. */
+static struct inode *
+walk_lookup (struct dir *dir, const char *name)
+{
+  struct inode *inode = NULL;
+
+  if (!strcmp (name, "."))
+    return inode_reopen (dir->inode);
+  if (!strcmp (name, ".."))
+    return inode_open (dir->inode->data.parent);
+  dir_lookup (dir, name, &inode);
+  return inode;
+}
+
+/* Resolves PATH, absolute or relative to the current directory,
+   one component at a time without copying it.  On success,
+   returns true, stores the directory that holds the last
+   component into *DIRP and the component itself into NAME, and,
+   if INODEP is non-null, stores the inode it names into *INODEP,
+   or a null pointer if it does not exist.  A path with no
+   components at all, such as "/", names the directory it starts
+   from, with NAME set to "".  The caller must close *DIRP and
+   *INODEP.
+   Fails if PATH is empty, if a component is too long, if one
+   before the last is missing or not a directory, or if the last
+   one's directory has been removed. */
+bool
+filesys_walk (const char *path, struct dir **dirp, char name[NAME_MAX + 1],
+              struct inode **inodep)
+{
+  struct dir *dir;
+  char next[NAME_MAX + 1];
+  int r;
+
+  if (*path == '\0')
+    return false;
+  if (*path == '/' || thread_current ()->current_dir == NULL)
+    dir = dir_open_root ();
+  else
+    dir = dir_reopen (thread_current ()->current_dir);
+  if (dir == NULL)
+    return false;
+
+  /* Step into each component that has another after it. */
+  name[0] = '\0';
+  r = next_component (&path, name);
+  while (r > 0 && (r = next_component (&path, next)) > 0)
+    {
+      struct inode *inode = walk_lookup (dir, name);
+
+      dir_close (dir);
+      if (inode == NULL || !inode->data.is_dir)
+        {
+          inode_close (inode);
+          return false;
+        }
+      dir = dir_open (inode);
+      if (dir == NULL)
+        return false;
+      strlcpy (name, next, NAME_MAX + 1);
+    }
+  if (r < 0 || dir->inode->removed)
+    {
+      dir_close (dir);
+      return false;
+    }
+
+  if (inodep != NULL)
+    *inodep = (name[0] != '\0' ? walk_lookup (dir, name)
+               : inode_reopen (dir->inode));
+  *dirp = dir;
+  return true;
+}
+
 /* Formats the file system. */
 static void
 do_format (void)
@@ -157,7 +254,7 @@ do_format (void)
   struct inode_disk *temp_disk = malloc(sizeof (struct inode_disk));
   inode_data_to_disk(temp_disk, &root_dir->inode->data);
   //disk_write(filesys_disk, ROOT_DIR_SECTOR, 
-  disk_write(filesys_disk, ROOT_DIR_SECTOR, temp_disk);
+  write_to_cache(ROOT_DIR_SECTOR, 0, temp_disk, DISK_SECTOR_SIZE, false);
   free(temp_disk);
   //dir_add_relative(root_dir, ".", ROOT_DIR_SECTOR);
   //dir_add_relative(root_dir, "..", ROOT_DIR_SECTOR);
@@ -18,5 +18,7 @@ bool filesys_create (const char *name, off_t initial_size, struct dir *file_dir)
 struct file *filesys_open (const char *name);
 struct file *filesys_open_dir (const char *name, struct dir *dir);
 bool filesys_remove (const char *name, struct dir *dir);
+bool filesys_walk (const char *path, struct dir **dirp,
+                   char name[NAME_MAX + 1], struct inode **inodep);
 
 #endif /* filesys/filesys.h */
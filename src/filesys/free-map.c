@@ -1,6 +1,8 @@
 #include "filesys/free-map.h"
 #include <bitmap.h>
 #include <debug.h>
+#include <round.h>
+#include "filesys/cache.h"
 #include "filesys/file.h"
 #include "filesys/filesys.h"
 #include "filesys/inode.h"
@@ -9,6 +11,33 @@ static struct file *free_map_file;   /* Free map file. */
 static struct bitmap *free_map;      /* Free map, one bit per disk sector. */
 struct lock free_map_lock;
 
+/* Sectors of the free map file that differ from what was last
+   written to it, one bit per sector.  Allocations and releases
+   only mark sectors here; free_map_flush() writes them. */
+static struct bitmap *free_map_dirty;
+
+/* Free sectors, and how many of them are set aside for delayed
+   sectors that have yet to be assigned a place on disk.  Ordinary
+   allocations may only use the difference. */
+static size_t free_cnt;
+static size_t reserved_cnt;
+
+/* Number of free map bits stored in one sector of its file. */
+#define BITS_PER_SECTOR (DISK_SECTOR_SIZE * 8)
+
+/* Marks the free map file sectors holding the bits for CNT
+   sectors starting at SECTOR as dirty. */
+static void
+free_map_mark_dirty (disk_sector_t sector, size_t cnt)
+{
+  size_t first = sector / BITS_PER_SECTOR;
+  size_t last = (sector + cnt - 1) / BITS_PER_SECTOR;
+
+  if (cnt == 0)
+    return;
+  bitmap_set_multiple (free_map_dirty, first, last - first + 1, true);
+}
+
 /* Initializes the free map. */
 void
 free_map_init (void) 
@@ -18,6 +47,12 @@ free_map_init (void)
     PANIC ("bitmap creation failed--disk is too large");
   bitmap_mark (free_map, FREE_MAP_SECTOR);
   bitmap_mark (free_map, ROOT_DIR_SECTOR);
+  free_cnt = bitmap_size (free_map) - 2;
+  reserved_cnt = 0;
+  free_map_dirty = bitmap_create (DIV_ROUND_UP (bitmap_file_size (free_map),
+                                                DISK_SECTOR_SIZE));
+  if (free_map_dirty == NULL)
+    PANIC ("bitmap creation failed--disk is too large");
   lock_init(&free_map_lock);
 }
 
@@ -28,21 +63,128 @@ free_map_init (void)
 bool
 free_map_allocate (size_t cnt, disk_sector_t *sectorp) 
 {
+  disk_sector_t sector = BITMAP_ERROR;
+
     lock_acquire(&free_map_lock);
-  disk_sector_t sector = bitmap_scan_and_flip (free_map, 0, cnt, false);
-  if (sector != BITMAP_ERROR
-      && free_map_file != NULL
-      && !bitmap_write (free_map, free_map_file))
+  if (free_cnt - reserved_cnt >= cnt)
+    sector = bitmap_scan_and_flip_next (free_map, cnt, false);
+  if (sector != BITMAP_ERROR)
     {
-      bitmap_set_multiple (free_map, sector, cnt, false); 
-      sector = BITMAP_ERROR;
+      free_cnt -= cnt;
+      free_map_mark_dirty (sector, cnt);
+      *sectorp = sector;
     }
-  if (sector != BITMAP_ERROR)
-    *sectorp = sector;
   lock_release(&free_map_lock);
   return sector != BITMAP_ERROR;
 }
 
+/* Allocates a run of up to CNT consecutive sectors near GOAL and
+   stores the first into *SECTORP.  Takes the run that begins at
+   the first free sector at or after GOAL if it is CNT long, or
+   else the first CNT-long run past that point; failing both,
+   settles for the shorter run at the first free sector.  Searches
+   wrap around to sector 0.
+   Returns the number of sectors allocated, 0 if none are free.
+   Must be called with free_map_lock held. */
+static size_t
+allocate_extent (disk_sector_t goal, size_t cnt, disk_sector_t *sectorp)
+{
+  size_t bit_cnt = bitmap_size (free_map);
+  size_t start, run = 0;
+
+  ASSERT (cnt > 0);
+
+  if (goal >= bit_cnt)
+    goal = 0;
+  start = bitmap_scan (free_map, goal, 1, false);
+  if (start == BITMAP_ERROR)
+    start = bitmap_scan (free_map, 0, 1, false);
+  if (start != BITMAP_ERROR)
+    {
+      for (run = 1; run < cnt && start + run < bit_cnt; run++)
+        if (bitmap_test (free_map, start + run))
+          break;
+      if (run < cnt)
+        {
+          size_t full = bitmap_scan (free_map, start, cnt, false);
+          if (full != BITMAP_ERROR)
+            {
+              start = full;
+              run = cnt;
+            }
+        }
+
+      bitmap_set_multiple (free_map, start, run, true);
+      free_map_mark_dirty (start, run);
+      free_cnt -= run;
+      *sectorp = start;
+    }
+  return run;
+}
+
+/* Allocates a run of up to CNT consecutive sectors near GOAL, as
+   described for allocate_extent(), from the sectors that are not
+   reserved.
+   Returns the number of sectors allocated, 0 if none are free. */
+size_t
+free_map_allocate_extent (disk_sector_t goal, size_t cnt,
+                          disk_sector_t *sectorp)
+{
+  size_t run = 0;
+
+  lock_acquire(&free_map_lock);
+  if (cnt > free_cnt - reserved_cnt)
+    cnt = free_cnt - reserved_cnt;
+  if (cnt > 0)
+    run = allocate_extent (goal, cnt, sectorp);
+  lock_release(&free_map_lock);
+  return run;
+}
+
+/* Like free_map_allocate_extent(), but takes the sectors out of
+   the CNT or more previously reserved with free_map_reserve(), so
+   it does not fail. */
+size_t
+free_map_allocate_reserved (disk_sector_t goal, size_t cnt,
+                            disk_sector_t *sectorp)
+{
+  size_t run;
+
+  lock_acquire(&free_map_lock);
+  ASSERT (cnt <= reserved_cnt);
+  run = allocate_extent (goal, cnt, sectorp);
+  reserved_cnt -= run;
+  lock_release(&free_map_lock);
+  return run;
+}
+
+/* Sets aside CNT sectors, without choosing which, for a later
+   free_map_allocate_reserved().
+   Returns false if fewer than CNT sectors are available. */
+bool
+free_map_reserve (size_t cnt)
+{
+  bool success;
+
+  lock_acquire(&free_map_lock);
+  success = free_cnt - reserved_cnt >= cnt;
+  if (success)
+    reserved_cnt += cnt;
+  lock_release(&free_map_lock);
+  return success;
+}
+
+/* Returns CNT sectors reserved with free_map_reserve() that will
+   not be allocated after all. */
+void
+free_map_unreserve (size_t cnt)
+{
+  lock_acquire(&free_map_lock);
+  ASSERT (cnt <= reserved_cnt);
+  reserved_cnt -= cnt;
+  lock_release(&free_map_lock);
+}
+
 /* Makes CNT sectors starting at SECTOR available for use. */
 void
 free_map_release (disk_sector_t sector, size_t cnt)
@@ -50,7 +192,35 @@ free_map_release (disk_sector_t sector, size_t cnt)
     lock_acquire(&free_map_lock);
   ASSERT (bitmap_all (free_map, sector, cnt));
   bitmap_set_multiple (free_map, sector, cnt, false);
-  bitmap_write (free_map, free_map_file);
+  free_map_mark_dirty (sector, cnt);
+  free_cnt += cnt;
+  lock_release(&free_map_lock);
+  cache_forget (sector, cnt);
+}
+
+/* Writes the dirty sectors of the free map to its file, each run
+   of consecutive ones in a single write.  The writes go to the
+   buffer cache, which takes them to disk with its own write-back. */
+void
+free_map_flush (void)
+{
+  size_t cnt = bitmap_size (free_map_dirty);
+  size_t start = 0;
+
+  lock_acquire(&free_map_lock);
+  while (free_map_file != NULL
+         && (start = bitmap_scan (free_map_dirty, start, 1, true)) != BITMAP_ERROR)
+    {
+      size_t end = bitmap_scan (free_map_dirty, start, 1, false);
+      if (end == BITMAP_ERROR)
+        end = cnt;
+      if (!bitmap_write_range (free_map, free_map_file,
+                               start * DISK_SECTOR_SIZE,
+                               (end - start) * DISK_SECTOR_SIZE))
+        PANIC ("can't write free map");
+      bitmap_set_multiple (free_map_dirty, start, end - start, false);
+      start = end;
+    }
   lock_release(&free_map_lock);
 }
 
@@ -63,6 +233,7 @@ free_map_open (void)
     PANIC ("can't open free map");
   if (!bitmap_read (free_map, free_map_file))
     PANIC ("can't read free map");
+  free_cnt = bitmap_count (free_map, 0, bitmap_size (free_map), false);
 
 }
 
@@ -70,11 +241,14 @@ free_map_open (void)
 void
 free_map_close (void) 
 {
+  free_map_flush ();
   file_close (free_map_file);
+  free_map_file = NULL;
 }
 
 /* Creates a new free map file on disk and writes the free map to
-   it. */
+   it.  Sectors freed while the file was being allocated and
+   written stay marked dirty, for free_map_flush() to write. */
 void
 free_map_create (void) 
 {
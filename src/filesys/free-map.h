@@ -10,8 +10,15 @@ void free_map_read (void);
 void free_map_create (void);
 void free_map_open (void);
 void free_map_close (void);
+void free_map_flush (void);
 
 bool free_map_allocate (size_t, disk_sector_t *);
+size_t free_map_allocate_extent (disk_sector_t goal, size_t cnt,
+                                 disk_sector_t *);
+size_t free_map_allocate_reserved (disk_sector_t goal, size_t cnt,
+                                   disk_sector_t *);
+bool free_map_reserve (size_t cnt);
+void free_map_unreserve (size_t cnt);
 void free_map_release (disk_sector_t, size_t);
 
 #endif /* filesys/free-map.h */
@@ -15,6 +15,11 @@
 
 #define DIRECT_INDEX_RANGE 9
 #define INDIRECT_INDEX_RANGE (9 + 128 * 4)
+#define DOUBLE_INDIRECT_INDEX_RANGE (INDIRECT_INDEX_RANGE + 128 * 128)
+
+/* Number of index blocks that map data: the indirect blocks and
+   the blocks under the double indirect one. */
+#define BLOCK_MAP_CNT (INDIRECT_INDEX_SIZE + 128)
 
 
 /* On-disk inode.
@@ -32,13 +37,18 @@
 //  };
 //
 
+/* Converts SRC to its on-disk form in DST.  A delayed sector has
+   no place on disk yet, so it is stored as a hole; the sector that
+   inode_assign_delayed() gives it later is stored with the inode
+   once more. */
 void inode_data_to_disk(struct inode_disk *dst, struct inode_data *src) {
     memset(dst, 0, sizeof (struct inode_disk));
     dst->length = src->length;
     dst->magic = src->magic;
     int i;
     for (i=0; i<9; i++) {
-        dst->direct_idx[i] = src->direct_idx[i];
+        if (!cache_is_delayed (src->direct_idx[i]))
+            dst->direct_idx[i] = src->direct_idx[i];
 
     }
     for (i=0; i<4; i++) {
@@ -46,7 +56,11 @@ void inode_data_to_disk(struct inode_disk *dst, struct inode_data *src) {
     }
     dst->double_indirect_idx = src->double_indirect_idx;
     dst->is_dir = src->is_dir;
+    dst->is_inline = src->is_inline;
+    dst->dir_hashed = src->dir_hashed;
     dst->parent = src->parent;
+    if (src->is_inline)
+        memcpy(dst->inline_data, src->inline_data, INODE_INLINE_MAX);
 
     //memcpy(dst, src, sizeof (struct inode_data));
 }
@@ -64,7 +78,11 @@ void inode_disk_to_data(struct inode_data *dst, struct inode_disk *src) {
     }
     dst->double_indirect_idx = src->double_indirect_idx;
     dst->is_dir = src->is_dir;
+    dst->is_inline = src->is_inline;
+    dst->dir_hashed = src->dir_hashed;
     dst->parent = src->parent;
+    if (src->is_inline)
+        memcpy(dst->inline_data, src->inline_data, INODE_INLINE_MAX);
 
     //memcpy(dst, src, sizeof (struct inode_data));
 }
@@ -105,414 +123,687 @@ byte_to_sector (off_t pos)
     return (pos / DISK_SECTOR_SIZE);
 }
 
-disk_sector_t
-byte_to_sector_indexed (struct inode *inode, off_t pos, int length)
+/* Hands out sectors to a file being allocated or grown from
+   contiguous extents reserved in the free map, so that its
+   sectors are laid out in runs and the free map is searched once
+   per run rather than once per sector.
+
+   With DELAY set, holes in the data are instead filled with
+   delayed sectors, which get their disk sectors later from an
+   allocator with RESERVED set.  See inode_assign_delayed(). */
+struct sector_allocator
 {
-    ASSERT(inode != NULL);
-    if (pos < ROUND_UP(length, DISK_SECTOR_SIZE)) {
-        disk_sector_t sector_pos = byte_to_sector(pos);
+    disk_sector_t next;         /* Next reserved sector. */
+    size_t left;                /* Reserved sectors not yet handed out. */
+    size_t wanted;              /* Estimate of sectors still needed. */
+    bool delay;                 /* Fill data holes with delayed sectors? */
+    bool reserved;              /* Assign disk sectors to delayed ones? */
+};
 
-        if (sector_pos < DIRECT_INDEX_RANGE) {
-            return inode->data.direct_idx[sector_pos];
-        }
-        else if (sector_pos < INDIRECT_INDEX_RANGE) {
-            int indirect_index = (sector_pos - DIRECT_INDEX_SIZE) / 128;
-            int block_entry = (sector_pos - DIRECT_INDEX_SIZE) % 128;
-            struct indirect_block accessed_block;
+/* Prepares SA to allocate about CNT sectors, starting as close
+   after GOAL as possible. */
+static void
+sector_alloc_init (struct sector_allocator *sa, disk_sector_t goal,
+                   size_t cnt)
+{
+    sa->next = goal;
+    sa->left = 0;
+    sa->delay = false;
+    sa->reserved = false;
+    /* Add room for the index blocks that go with CNT sectors. */
+    sa->wanted = cnt + DIV_ROUND_UP (cnt, 128) + 1;
+}
+
+/* Stores the next sector from SA into *SECTORP, reserving a new
+   extent if the current one is used up.  Returns false if the
+   disk is full. */
+static bool
+sector_alloc (struct sector_allocator *sa, disk_sector_t *sectorp)
+{
+    if (sa->left == 0) {
+        size_t cnt = sa->wanted > 0 ? sa->wanted : 1;
+
+        if (sa->reserved)
+            sa->left = free_map_allocate_reserved (sa->next, cnt, &sa->next);
+        else
+            sa->left = free_map_allocate_extent (sa->next, cnt, &sa->next);
+        if (sa->left == 0)
+            return false;
+    }
+    *sectorp = sa->next++;
+    sa->left--;
+    if (sa->wanted > 0)
+        sa->wanted--;
+    return true;
+}
+
+/* Returns the sectors SA reserved but did not hand out. */
+static void
+sector_alloc_done (struct sector_allocator *sa)
+{
+    if (sa->left > 0)
+        free_map_release (sa->next, sa->left);
+    sa->left = 0;
+}
+
+/* Writes DATA to inode sector SECTOR, converting it to its
+   on-disk form directly in the buffer cache. */
+static void
+inode_data_store (disk_sector_t sector, struct inode_data *data)
+{
+    inode_data_to_disk (cache_get_blank (sector), data);
+    cache_put (sector, true);
+}
+
+/* Moves the inline data of INODE, whose rwlock must be held for
+   writing, out to a data sector of its own, so that the file can
+   grow past INODE_INLINE_MAX bytes.  Returns false if the disk is
+   full. */
+static bool
+inode_uninline (struct inode *inode)
+{
+    struct inode_data *data = &inode->data;
+    struct sector_allocator sa;
+    disk_sector_t sector;
+
+    ASSERT (data->is_inline);
+
+    if (data->length > 0) {
+        sector_alloc_init (&sa, inode->sector + 1, 1);
+        if (!sector_alloc (&sa, &sector))
+            return false;
+        sector_alloc_done (&sa);
+
+        uint8_t *block = cache_get_blank (sector);
+        memcpy (block, data->inline_data, data->length);
+        cache_put (sector, true);
+        data->direct_idx[0] = sector;
+    }
+    memset (data->inline_data, 0, INODE_INLINE_MAX);
+    data->is_inline = false;
+    return true;
+}
 
-            disk_read(filesys_disk, inode->data.indirect_idx[indirect_index], &accessed_block);
-            return accessed_block.entry[block_entry];
+/* Stores a new sector from SA into *SECTORP and zeroes it in the
+   buffer cache, so that it reads back as zeros just like the hole
+   it replaces.  Returns false if the disk is full. */
+static bool
+sector_alloc_zeroed (struct sector_allocator *sa, disk_sector_t *sectorp)
+{
+    if (!sector_alloc (sa, sectorp))
+        return false;
+    cache_get_blank (*sectorp);
+    cache_put (*sectorp, true);
+    return true;
+}
+
+/* Stores a new delayed sector into *SECTORP, setting aside a disk
+   sector for it in the free map.  Returns false if either runs
+   out. */
+static bool
+sector_alloc_delayed (disk_sector_t *sectorp)
+{
+    disk_sector_t sector;
+
+    if (!free_map_reserve (1))
+        return false;
+    sector = cache_new_delayed ();
+    if (sector == 0) {
+        free_map_unreserve (1);
+        return false;
+    }
+    *sectorp = sector;
+    return true;
+}
+
+/* Moves delayed sector *SECTORP to a disk sector from SA, which
+   must be for that, and stores the new sector into *SECTORP.
+   Leaves *SECTORP alone if the disk is full. */
+static void
+assign_delayed (disk_sector_t *sectorp, struct sector_allocator *sa)
+{
+    disk_sector_t sector;
+
+    if (sector_alloc (sa, &sector)) {
+        cache_assign (*sectorp, sector);
+        *sectorp = sector;
+    }
+}
+
+/* Returns the sector that index entry *ENTRYP points to, or 0 if
+   the entry is a hole.  DIRECT is true if the entry is one of an
+   inode's direct entries, the only entries stored on disk that may
+   hold a delayed sector.  If SA is non-null, a hole is first
+   filled with a zeroed sector from SA, or in a direct entry with a
+   delayed sector if SA says so and one is to be had, and a delayed
+   sector is moved to a disk sector if SA is for that. */
+static disk_sector_t
+map_entry (disk_sector_t *entryp, struct sector_allocator *sa, bool direct)
+{
+    if (sa == NULL)
+        return *entryp;
+    if (*entryp == 0) {
+        if (!direct || !sa->delay || !sector_alloc_delayed (entryp))
+            sector_alloc_zeroed (sa, entryp);
+    }
+    else if (direct && sa->reserved && cache_is_delayed (*entryp))
+        assign_delayed (entryp, sa);
+    return *entryp;
+}
+
+/* Returns entry IDX of index block BLOCK, updating it as
+   map_entry() does.  The block is accessed in place in the buffer
+   cache.  A BLOCK of 0 is itself a hole and holds only holes. */
+static disk_sector_t
+index_block_entry (disk_sector_t block, int idx, struct sector_allocator *sa)
+{
+    struct indirect_block *ib;
+    disk_sector_t old, entry;
+
+    if (block == 0)
+        return 0;
+    ib = cache_get (block);
+    old = ib->entry[idx];
+    entry = map_entry (&ib->entry[idx], sa, false);
+    cache_put (block, entry != old);
+    return entry;
+}
+
+/* Returns the slot of INODE's block map for the index block that
+   maps data sector SECTOR_POS, which must lie past the direct
+   entries, and stores that sector's entry number into *IDXP.
+   Returns a null pointer if SECTOR_POS is beyond the largest
+   file. */
+static disk_sector_t **
+block_map_slot (struct inode *inode, size_t sector_pos, size_t *idxp)
+{
+    size_t chunk;
+
+    if (sector_pos < INDIRECT_INDEX_RANGE)
+        chunk = (sector_pos - DIRECT_INDEX_RANGE) / 128;
+    else if (sector_pos < DOUBLE_INDIRECT_INDEX_RANGE)
+        chunk = (INDIRECT_INDEX_SIZE
+                 + (sector_pos - INDIRECT_INDEX_RANGE) / 128);
+    else
+        return NULL;
+    *idxp = (sector_pos - DIRECT_INDEX_RANGE) % 128;
+    return inode->block_map != NULL ? &inode->block_map[chunk] : NULL;
+}
+
+/* Returns INODE's in-memory copy of the index block that maps data
+   sector SECTOR_POS, which must lie past the direct entries, and
+   stores that sector's entry number into *IDXP.  Reads the copy in
+   on first use.  Returns a null pointer if the index block does
+   not exist yet, which means SECTOR_POS is a hole, or if memory is
+   short, in which case the caller must walk the index itself. */
+static disk_sector_t *
+block_map_get (struct inode *inode, size_t sector_pos, size_t *idxp)
+{
+    struct inode_data *data = &inode->data;
+    disk_sector_t **slot;
+    disk_sector_t *copy;
+    disk_sector_t block;
+    size_t idx;
+
+    *idxp = (sector_pos - DIRECT_INDEX_RANGE) % 128;
+    if (inode->block_map == NULL) {
+        disk_sector_t **map = calloc (BLOCK_MAP_CNT, sizeof *map);
+        if (map == NULL)
+            return NULL;
+        lock_acquire (&inode->block_map_lock);
+        if (inode->block_map == NULL)
+            inode->block_map = map;
+        else
+            free (map);
+        lock_release (&inode->block_map_lock);
+    }
+
+    slot = block_map_slot (inode, sector_pos, idxp);
+    if (slot == NULL)
+        return NULL;
+    if (*slot != NULL)
+        return *slot;
+
+    idx = sector_pos - DIRECT_INDEX_RANGE;
+    if (sector_pos < INDIRECT_INDEX_RANGE)
+        block = data->indirect_idx[idx / 128];
+    else {
+        idx = sector_pos - INDIRECT_INDEX_RANGE;
+        block = data->double_indirect_idx;
+        if (block != 0) {
+            disk_sector_t *ib = cache_get (block);
+            disk_sector_t entry = ib[idx / 128];
+            cache_put (block, false);
+            block = entry;
         }
-        else {
-            int first_block_entry = (sector_pos - INDIRECT_INDEX_RANGE) / 128;
-            int second_block_entry = (sector_pos - INDIRECT_INDEX_RANGE) % 128;
-            struct indirect_block accessed_first_block;
-            struct indirect_block accessed_second_block;
-            disk_read(filesys_disk, inode->data.double_indirect_idx, &accessed_first_block);
-            disk_read(filesys_disk, accessed_first_block.entry[first_block_entry], &accessed_second_block);
-            return accessed_second_block.entry[second_block_entry];
+    }
+    if (block == 0)
+        return NULL;
+
+    copy = malloc (DISK_SECTOR_SIZE);
+    if (copy == NULL)
+        return NULL;
+    memcpy (copy, cache_get (block), DISK_SECTOR_SIZE);
+    cache_put (block, false);
+
+    lock_acquire (&inode->block_map_lock);
+    if (*slot == NULL)
+        *slot = copy;
+    else {
+        free (copy);
+        copy = *slot;
+    }
+    lock_release (&inode->block_map_lock);
+    return copy;
+}
+
+/* Returns the entry for data sector SECTOR_POS of INODE, which
+   lies past the direct entries, in index block BLOCK, updating it
+   as map_entry() does with SA, which must be non-null.
+
+   Index blocks are written back like any other sector, so a
+   delayed sector is recorded only in INODE's block map, and the
+   entry in BLOCK stays a hole until the delayed sector is given
+   a disk sector.  A hole is therefore only filled with a delayed
+   sector if the block map has a copy of BLOCK; inode_map_sector()
+   puts the delayed sector there. */
+static disk_sector_t
+index_leaf_entry (struct inode *inode, size_t sector_pos,
+                  disk_sector_t block, struct sector_allocator *sa)
+{
+    disk_sector_t *copy;
+    disk_sector_t sector;
+    size_t idx;
+
+    copy = block_map_get (inode, sector_pos, &idx);
+    if (copy != NULL && cache_is_delayed (copy[idx])) {
+        sector = copy[idx];
+        if (sa->reserved) {
+            assign_delayed (&sector, sa);
+            if (!cache_is_delayed (sector)) {
+                struct indirect_block *ib = cache_get (block);
+                ib->entry[idx] = sector;
+                cache_put (block, true);
+            }
         }
+        return sector;
+    }
+    if (copy != NULL && copy[idx] == 0 && sa->delay
+        && sector_alloc_delayed (&sector))
+        return sector;
+    return index_block_entry (block, idx, sa);
+}
+
+/* Frees INODE's block map. */
+static void
+block_map_free (struct inode *inode)
+{
+    size_t i;
+
+    if (inode->block_map == NULL)
+        return;
+    for (i = 0; i < BLOCK_MAP_CNT; i++)
+        free (inode->block_map[i]);
+    free (inode->block_map);
+    inode->block_map = NULL;
+}
+
+/* Returns the disk sector holding data sector SECTOR_POS of INODE,
+   or 0 if that sector is a hole.  It may be a delayed sector.
+
+   If SA is non-null, fills the hole, and any index blocks missing
+   on the way to it, with sectors from SA as map_entry() does; 0
+   then means the disk is full or SECTOR_POS is beyond the largest
+   file.  Doing so requires INODE's rwlock held for writing, and
+   INODE's data must be written back afterward.  A delayed sector
+   is only valid while INODE's rwlock is held, since it may be
+   assigned a disk sector as soon as it is released.
+
+   Lookups past the direct entries are answered from INODE's block
+   map where possible; changes go to the index and are then copied
+   into the block map, except that delayed sectors past the direct
+   entries go to the block map alone, as index_leaf_entry()
+   explains. */
+static disk_sector_t
+inode_map_sector (struct inode *inode, size_t sector_pos,
+                  struct sector_allocator *sa)
+{
+    struct inode_data *data = &inode->data;
+    disk_sector_t *copy, **slot, sector = 0;
+    size_t map_idx;
+
+    if (sector_pos < DIRECT_INDEX_RANGE)
+        return map_entry (&data->direct_idx[sector_pos], sa, true);
+    if (sa == NULL) {
+        copy = block_map_get (inode, sector_pos, &map_idx);
+        if (copy != NULL)
+            return copy[map_idx];
+    }
+
+    if (sector_pos < INDIRECT_INDEX_RANGE) {
+        size_t idx = sector_pos - DIRECT_INDEX_RANGE;
+        disk_sector_t block = map_entry (&data->indirect_idx[idx / 128], sa,
+                                         false);
+
+        sector = (sa != NULL
+                  ? index_leaf_entry (inode, sector_pos, block, sa)
+                  : index_block_entry (block, idx % 128, NULL));
+    }
+    else if (sector_pos < DOUBLE_INDIRECT_INDEX_RANGE) {
+        size_t idx = sector_pos - INDIRECT_INDEX_RANGE;
+        disk_sector_t block = map_entry (&data->double_indirect_idx, sa,
+                                         false);
+
+        block = index_block_entry (block, idx / 128, sa);
+        sector = (sa != NULL
+                  ? index_leaf_entry (inode, sector_pos, block, sa)
+                  : index_block_entry (block, idx % 128, NULL));
+    }
+
+    if (sa != NULL) {
+        slot = block_map_slot (inode, sector_pos, &map_idx);
+        if (slot != NULL && *slot != NULL)
+            (*slot)[map_idx] = sector;
+    }
+    return sector;
+}
+
+/* Looks up data sector SECTOR_POS of INODE as inode_map_sector()
+   does, but only from what is already in memory: the direct
+   entries and the index blocks in INODE's block map.  Stores the
+   sector, or 0 for a hole, into *SECTORP and returns true, or
+   returns false if finding it would mean reading an index
+   block. */
+static bool
+inode_peek_sector (struct inode *inode, size_t sector_pos,
+                   disk_sector_t *sectorp)
+{
+    disk_sector_t **slot;
+    size_t map_idx;
+
+    if (sector_pos < DIRECT_INDEX_RANGE) {
+        *sectorp = inode->data.direct_idx[sector_pos];
+        return true;
+    }
+    slot = block_map_slot (inode, sector_pos, &map_idx);
+    if (slot == NULL || *slot == NULL)
+        return false;
+    *sectorp = (*slot)[map_idx];
+    return true;
+}
+
+/* Counts how many of the CNT index entries in ENTRIES, at least
+   1, continue the run that the first begins: consecutive disk
+   sectors, or holes if the first is a hole.  A delayed sector is
+   a run of its own. */
+static size_t
+entry_run (const disk_sector_t *entries, size_t cnt)
+{
+    disk_sector_t first = entries[0];
+    size_t n = 1;
+
+    if (cache_is_delayed (first))
+        return 1;
+    if (first == 0)
+        while (n < cnt && entries[n] == 0)
+            n++;
+    else
+        while (n < cnt && entries[n] == first + n)
+            n++;
+    return n;
+}
+
+/* Like inode_map_sector() without SA, but maps up to CNT data
+   sectors of INODE from SECTOR_POS on at once.  Stores the first
+   one's disk sector, 0 for a hole, into *SECTORP and returns the
+   length of the run it begins, as entry_run() counts it.  A run
+   ends at the end of an index block, so each index block on the
+   way is read only once per call. */
+static size_t
+inode_map_run (struct inode *inode, size_t sector_pos, size_t cnt,
+               disk_sector_t *sectorp)
+{
+    struct inode_data *data = &inode->data;
+    disk_sector_t *copy;
+    disk_sector_t block;
+    size_t idx, n;
+
+    ASSERT (cnt > 0);
+
+    if (sector_pos < DIRECT_INDEX_RANGE) {
+        if (cnt > DIRECT_INDEX_RANGE - sector_pos)
+            cnt = DIRECT_INDEX_RANGE - sector_pos;
+        *sectorp = data->direct_idx[sector_pos];
+        return entry_run (&data->direct_idx[sector_pos], cnt);
+    }
+    else if (sector_pos >= DOUBLE_INDIRECT_INDEX_RANGE) {
+        *sectorp = 0;
+        return 1;
+    }
 
+    copy = block_map_get (inode, sector_pos, &idx);
+    if (cnt > 128 - idx)
+        cnt = 128 - idx;
+    if (copy != NULL) {
+        *sectorp = copy[idx];
+        return entry_run (&copy[idx], cnt);
     }
+
+    /* No copy in the block map: either the index block does not
+       exist or memory is short. */
+    if (sector_pos < INDIRECT_INDEX_RANGE)
+        block = data->indirect_idx[(sector_pos - DIRECT_INDEX_RANGE) / 128];
+    else
+        block = index_block_entry (data->double_indirect_idx,
+                                   (sector_pos - INDIRECT_INDEX_RANGE) / 128,
+                                   NULL);
+    if (block == 0) {
+        *sectorp = 0;       /* The whole index block is a hole. */
+        return cnt;
+    }
+    struct indirect_block *ib = cache_get (block);
+    *sectorp = ib->entry[idx];
+    n = entry_run (&ib->entry[idx], cnt);
+    cache_put (block, false);
+    return n;
+}
+
+/* Returns the disk sector that contains byte offset POS within
+   INODE, whose length is LENGTH, or 0 if that part of INODE is a
+   hole, which reads as zeros.
+   Returns -1 if POS is past the end of INODE. */
+disk_sector_t
+byte_to_sector_indexed (struct inode *inode, off_t pos, int length)
+{
+    ASSERT(inode != NULL);
+    if (pos < ROUND_UP(length, DISK_SECTOR_SIZE))
+        return inode_map_sector (inode, byte_to_sector (pos), NULL);
     else
         return -1;
 }
 
-bool alloc_sectors(struct inode_disk *disk_inode, disk_sector_t sector, size_t sectors) {
-    bool success = false;
-    size_t i, j;
-    static char zeros[DISK_SECTOR_SIZE];
+/* Returns the sector after which to place data sector SECTOR_POS
+   of INODE: the sector holding the data just before it, if that
+   has a place on disk, or else INODE's own sector. */
+static disk_sector_t
+alloc_goal (struct inode *inode, size_t sector_pos)
+{
+    disk_sector_t prev = 0;
+
+    if (sector_pos > 0)
+        prev = inode_map_sector (inode, sector_pos - 1, NULL);
+    return prev != 0 && !cache_is_delayed (prev) ? prev : inode->sector;
+}
 
-    /* CASE 1 */
-    if (sectors <= DIRECT_INDEX_RANGE) {
-        for (i = 0 ; i < sectors ; i++) {
-            free_map_allocate(1, &disk_inode->direct_idx[i]);
-            disk_write(filesys_disk, disk_inode->direct_idx[i], zeros);
+/* Frees data sector SECTOR, which may be a delayed sector. */
+static void
+release_sector (disk_sector_t sector)
+{
+    if (cache_is_delayed (sector)) {
+        cache_discard (sector);
+        free_map_unreserve (1);
+    }
+    else
+        free_map_release (sector, 1);
+}
+
+/* Releases index block BLOCK, which is DEPTH levels above the
+   data, along with every sector it points to. */
+static void
+free_index_block (disk_sector_t block, int depth)
+{
+    struct indirect_block *ib = cache_get (block);
+    int i;
+
+    for (i = 0; i < 128; i++)
+        if (ib->entry[i] != 0) {
+            if (depth > 1)
+                free_index_block (ib->entry[i], depth - 1);
+            else
+                release_sector (ib->entry[i]);
         }
+    cache_put (block, false);
+    free_map_release (block, 1);
+}
 
-        disk_write(filesys_disk, sector, disk_inode);
-
-        success = true;
-    }
-
-    /* CASE 2 */
-    else if (sectors <= INDIRECT_INDEX_RANGE) {
-          for (i = 0 ; i < DIRECT_INDEX_SIZE ; i++ ) {
-              free_map_allocate(1, &disk_inode->direct_idx[i]);
-              disk_write(filesys_disk, disk_inode->direct_idx[i], zeros);
-              /* FILLED ZERO IN ACTUAL DATA SECTOR */
-          }
-
-          size_t last_indirect_index = (sectors - DIRECT_INDEX_SIZE) / 128;
-          size_t last_indirect_block_index = (sectors - DIRECT_INDEX_SIZE) % 128;
-          struct indirect_block single;
-          for (i = 0 ; i < last_indirect_index ; i++) {
-              free_map_allocate(1, &disk_inode->indirect_idx[i]);
-              //Fill the indirect block's entry
-              for (j = 0 ; j < 128 ; j++) {
-                  free_map_allocate(1, &single.entry[j]);
-                  disk_write(filesys_disk, single.entry[j], zeros);
-                  //printf("%d block entry : %d sector\n", j, single.entry[j]);
-                  /* FILLED ZERO IN ACTUAL DATA SECTOR */
-              }
-              disk_write(filesys_disk, disk_inode->indirect_idx[i], &single);
-          }
-   
-          /* Last indirect block - partially filled */
-          if (last_indirect_block_index != 0) {
-              free_map_allocate(1, &disk_inode->indirect_idx[last_indirect_index]);
-              for (i = 0; i < last_indirect_block_index; i++) {
-                  free_map_allocate(1, &single.entry[i]);
-                  disk_write(filesys_disk, single.entry[i], zeros);
-                  /* FILLED ZERO IN ACTUAL DATA SECTOR */
-
-              }
-              disk_write(filesys_disk, disk_inode->indirect_idx[last_indirect_index], &single);
-              disk_write(filesys_disk, sector, disk_inode);
-
-              success = true;
-          }
-          else {
-              disk_write(filesys_disk, sector, disk_inode);
-              success = true;
-          }
-      }
-
-      /* CASE 3 */
-      else {
-          //Doubly-indirect block
-          //1. Fill all of the previous index first!
-          for (i = 0 ; i <= DIRECT_INDEX_SIZE ; i++ ) {
-              free_map_allocate(1, &disk_inode->direct_idx[i]);
-              disk_write(filesys_disk, disk_inode->direct_idx[i], zeros);
-              /* FILLED ZERO IN ACTUAL DATA SECTOR */
-          }
-
-          struct indirect_block single;
-          struct indirect_block doubly;
-          for (i = 0 ; i <= INDIRECT_INDEX_SIZE ; i++) {
-              free_map_allocate(1, &disk_inode->indirect_idx[i]);
-              //Fill the indirect block's entry
-              for (j = 0 ; j < 128 ; j++) {
-                  free_map_allocate(1, &single.entry[j]);
-                  disk_write(filesys_disk, single.entry[j], zeros);
-                  /* FILLED ZERO IN ACTUAL DATA SECTOR */
-              }
-              disk_write(filesys_disk, disk_inode->indirect_idx[i], &single);
-          }
-
-          //2. Fill the 2-level index blocks
-          size_t first_level_index = (sectors - INDIRECT_INDEX_RANGE) / 128;
-          size_t second_level_index = (sectors - INDIRECT_INDEX_RANGE) % 128;
-          free_map_allocate(1, &disk_inode->double_indirect_idx);
-
-          for (i = 0 ; i < first_level_index ; i++) {
-              free_map_allocate(1, &single.entry[i]);
-              for (j = 0 ; j < 128 ; j++) {
-                  free_map_allocate(1, &doubly.entry[j]);
-                  disk_write(filesys_disk, doubly.entry[j], zeros);
-                  /* FILLED ZERO IN ACTUAL DATA SECTOR */
-              }
-              disk_write(filesys_disk, single.entry[i], &doubly);
-          }
-          /* Fill the last partial one */
-          if (second_level_index != 0) {
-              free_map_allocate(1, &single.entry[first_level_index]);
-              for (j = 0; j < second_level_index; j++) {
-                  free_map_allocate(1, &doubly.entry[j]);
-                  disk_write(filesys_disk, doubly.entry[j], zeros);
-                  /* FILLED ZERO IN ACTUAL DATA SECTOR */
-              }
-              disk_write(filesys_disk, single.entry[first_level_index], &doubly);
-              /* ALL INDEX ALLOCATED */
-              disk_write(filesys_disk, disk_inode->double_indirect_idx, &single);
-              disk_write(filesys_disk, sector, disk_inode);
-
-              success = true;
-          }
-          else {
-              disk_write(filesys_disk, disk_inode->double_indirect_idx, &single);
-        disk_write(filesys_disk, sector, disk_inode);
-              success = true;
-          }
-      } //end of 'else'
-      return success;
-}
-
-bool alloc_sectors_grow(struct inode *inode, disk_sector_t sector, size_t sectors, size_t newlength) {
-    bool success = false;
-    struct inode_data *disk_inode = &inode->data;
+/* Releases the delayed sectors in INODE's block map, which the
+   index blocks themselves do not record. */
+static void
+block_map_release_delayed (struct inode *inode)
+{
     size_t i, j;
-    static char zeros[DISK_SECTOR_SIZE];
-
-    size_t pos = byte_to_sector(disk_inode->length);
-    //inode->data.length = newlength;
-
-    //printf("current %dst sector -> grow to %d sectors\n", pos, sectors);
-       
-    /* CASE 1 */
-    if (sectors <= DIRECT_INDEX_RANGE) {
-        for (i = pos ; i < sectors ; i++) {
-            free_map_allocate(1, &disk_inode->direct_idx[i]);
-            //printf("alloc direct_idx[%d] = %d\n", i, disk_inode->direct_idx[i]);
-            disk_write(filesys_disk, disk_inode->direct_idx[i], zeros);
-        }
-        struct inode_disk *temp_sector = malloc(sizeof (struct inode_disk));
-        inode_data_to_disk(temp_sector, disk_inode);
-        disk_write(filesys_disk, sector, temp_sector);
-        free(temp_sector);
-        success = true;
-    }
-
-    /* CASE 2 */
-    else if (sectors <= INDIRECT_INDEX_RANGE) {
-        if (pos < DIRECT_INDEX_SIZE) {
-          for (i = pos; i < DIRECT_INDEX_SIZE ; i++ ) {
-              free_map_allocate(1, &disk_inode->direct_idx[i]);
-              //printf("alloc direct_idx[%d], sector %d\n", i, disk_inode->direct_idx[i]);
-              disk_write(filesys_disk, disk_inode->direct_idx[i], zeros);
-              /* FILLED ZERO IN ACTUAL DATA SECTOR */
-          }
-        }
 
-        size_t curr_indirect_index = (pos - DIRECT_INDEX_SIZE) / 128;
-        size_t curr_block_entry = (pos - DIRECT_INDEX_SIZE) % 128;
-        if (pos < DIRECT_INDEX_SIZE) {
-            curr_indirect_index = 0;
-            curr_block_entry = 0;
-        }
+    if (inode->block_map == NULL)
+        return;
+    for (i = 0; i < BLOCK_MAP_CNT; i++)
+        if (inode->block_map[i] != NULL)
+            for (j = 0; j < 128; j++)
+                if (cache_is_delayed (inode->block_map[i][j]))
+                    release_sector (inode->block_map[i][j]);
+}
 
+/* Open inodes, hashed by sector, so that opening a single inode
+   twice returns the same `struct inode'.  open_inodes_lock guards
+   the table and every open inode's open_cnt. */
+static struct hash open_inodes;
+static struct lock open_inodes_lock;
 
-          size_t last_indirect_index = (sectors - DIRECT_INDEX_SIZE) / 128;
-          size_t last_indirect_block_index = (sectors - DIRECT_INDEX_SIZE) % 128;
-          struct indirect_block single;
-          for (i = curr_indirect_index ; i < last_indirect_index ; i++) {
-              if (i != curr_indirect_index) {
-                  /* New index block */
-                  free_map_allocate(1, &disk_inode->indirect_idx[i]);
-                  //printf("Create single indirect index block[%d] : %d\n", i, disk_inode->indirect_idx[i]);
-              }               
-              //Fill the indirect block's entry
-              if (i == curr_indirect_index) {
-                  j = curr_block_entry;
-                  if (curr_block_entry == 0) {
-                      /* New index block */
-                      free_map_allocate(1, &disk_inode->indirect_idx[i]);
-                  }
-                  else {
-                      /* partially filled index block is already exist */
-                      disk_read(filesys_disk, disk_inode->indirect_idx[i], &single); 
-                  }
-              } else {
-                  j = 0;
-              }
-
-              for ( ; j < 128 ; j++) {
-                  free_map_allocate(1, &single.entry[j]);
-                  disk_write(filesys_disk, single.entry[j], zeros);
-                  //printf("%d block entry : %d sector\n", j, single.entry[j]);
-                  /* FILLED ZERO IN ACTUAL DATA SECTOR */
-              }
-              disk_write(filesys_disk, disk_inode->indirect_idx[i], &single);
-          }
-
-          /* Last indirect block - partially filled */
-          if (last_indirect_block_index != 0) {
-              if (last_indirect_index == curr_indirect_index) {
-                  /* Should handle case : start position is not 'first of the index block' - index block is already allocated! */
-                  i = curr_block_entry;
-                  if (curr_block_entry == 0) {
-                      free_map_allocate(1, &disk_inode->indirect_idx[last_indirect_index]);
-
-                      //printf("Create single indirect index block[%d] : %d\n", i, disk_inode->indirect_idx[i]);
-                  }
-                  else {
-                      /* partially filled index block is already exist */
-                      disk_read(filesys_disk, disk_inode->indirect_idx[curr_indirect_index], &single); 
-                      //printf("read from existing index block %d\n", disk_inode->indirect_idx[i]);
-                  }
-              } else {
-                  free_map_allocate(1, &disk_inode->indirect_idx[last_indirect_index]);
-                  //printf("Create single indirect index block[%d] : %d\n", i, disk_inode->indirect_idx[i]);
-                  i = 0;
-              }
-              for ( ; i < last_indirect_block_index; i++) {
-                  free_map_allocate(1, &single.entry[i]);
-                  //printf("alloc single.entry[%d] : %d\n", i, single.entry[i]);
-                  disk_write(filesys_disk, single.entry[i], zeros);
-                  /* FILLED ZERO IN ACTUAL DATA SECTOR */
-              }
-              disk_write(filesys_disk, disk_inode->indirect_idx[last_indirect_index], &single);
-              struct inode_disk *temp_sector = malloc(sizeof (struct inode_disk));
-              inode_data_to_disk(temp_sector, disk_inode);
-              disk_write(filesys_disk, sector, temp_sector);
-              free(temp_sector);
-              success = true;
-          }
-          else {
-              struct inode_disk *temp_sector = malloc(sizeof (struct inode_disk));
-              inode_data_to_disk(temp_sector, disk_inode);
-              disk_write(filesys_disk, sector, temp_sector);
-              free(temp_sector);
-              success = true;
-          }
-    }
-
-    /* CASE 3 */
-    else {
-        //Doubly-indirect block
-        //1. Fill all of the previous index first!
-        if (pos < DIRECT_INDEX_SIZE) {
-            for (i = pos ; i < DIRECT_INDEX_SIZE ; i++ ) {
-                  free_map_allocate(1, &disk_inode->direct_idx[i]);
-                  disk_write(filesys_disk, disk_inode->direct_idx[i], zeros);
-                  /* FILLED ZERO IN ACTUAL DATA SECTOR */
-              }
-          }
-
-          struct indirect_block single;
-          struct indirect_block doubly;
-
-          if (pos < INDIRECT_INDEX_RANGE) {
-              int curr_indirect_index = (pos - DIRECT_INDEX_SIZE) / 128;
-              int curr_block_entry = (pos - DIRECT_INDEX_SIZE) % 128;
-
-              if (pos < DIRECT_INDEX_SIZE) {
-                  curr_indirect_index = 0;
-                  curr_block_entry = 0;
-              }
-
-              for (i = curr_indirect_index ; i < INDIRECT_INDEX_SIZE ; i++) {
-                  //Fill the single indirect block's entry
-                  if (i == curr_indirect_index) {
-                      j = curr_block_entry;
-                      if (curr_block_entry == 0) {
-                          free_map_allocate(1, &disk_inode->indirect_idx[i]);
-                      } else {
-                          /* partially filled index block is already exist */
-                          disk_read(filesys_disk, disk_inode->indirect_idx[i], &single);
-                      }
-                  } else {
-
-                      free_map_allocate(1, &disk_inode->indirect_idx[i]);
-                      j = 0;
-                  }
-                  for ( ; j < 128 ; j++) {
-                      free_map_allocate(1, &single.entry[j]);
-                      disk_write(filesys_disk, single.entry[j], zeros);
-                      /* FILLED ZERO IN ACTUAL DATA SECTOR */
-                  }
-                  disk_write(filesys_disk, disk_inode->indirect_idx[i], &single);
-              }
-          }
-
-          //2. Fill the 2-level index blocks
-          size_t curr_first_idx = (pos - INDIRECT_INDEX_RANGE) / 128;
-          size_t curr_second_idx = (pos - INDIRECT_INDEX_RANGE) % 128;
-
-          if (pos < INDIRECT_INDEX_RANGE) {
-              curr_first_idx = 0;
-              curr_second_idx = 0;
-          }
-
-          size_t first_level_index = (sectors - INDIRECT_INDEX_RANGE) / 128;
-          size_t second_level_index = (sectors - INDIRECT_INDEX_RANGE) % 128;
-          if(curr_first_idx == 0 && curr_second_idx == 0) {
-            free_map_allocate(1, &disk_inode->double_indirect_idx);
-          } else {
-              disk_read(filesys_disk, disk_inode->double_indirect_idx, &single);
-          }
-
-          for (i = curr_first_idx ; i < first_level_index ; i++) {
-
-              if (i == curr_first_idx) {
-                  j = curr_second_idx;
-                  if (curr_second_idx == 0) {
-
-                      free_map_allocate(1, &single.entry[i]);
-                  } else {
-                      disk_read(filesys_disk, single.entry[i], &doubly);
-                  }
-              }
-              else {
-                  free_map_allocate(1, &single.entry[i]);
-                  j = 0;
-              }
-              for ( ; j < 128 ; j++) {
-                  free_map_allocate(1, &doubly.entry[j]);
-                  disk_write(filesys_disk, doubly.entry[j], zeros);
-                  /* FILLED ZERO IN ACTUAL DATA SECTOR */
-              }
-              disk_write(filesys_disk, single.entry[i], &doubly);
-          }
-          /* Fill the last partial one */
-          if (second_level_index != 0) {
-              free_map_allocate(1, &single.entry[first_level_index]);
-              if (first_level_index == curr_first_idx) {
-                  j = curr_second_idx;
-                  if (j == 0) {
-                      free_map_allocate(1, &single.entry[first_level_index]);
-                  } else {
-                      disk_read(filesys_disk, single.entry[first_level_index], &doubly);
-                  }
-              } else {
-                  free_map_allocate(1, &single.entry[first_level_index]);
-                  j = 0;
-              } 
-              for ( ; j < second_level_index; j++) {
-                  free_map_allocate(1, &doubly.entry[j]);
-                  disk_write(filesys_disk, doubly.entry[j], zeros);
-                  /* FILLED ZERO IN ACTUAL DATA SECTOR */
-              }
-              disk_write(filesys_disk, single.entry[first_level_index], &doubly);
-              /* ALL INDEX ALLOCATED */
-              disk_write(filesys_disk, disk_inode->double_indirect_idx, &single);
-              struct inode_disk *temp_sector = malloc(sizeof (struct inode_disk));
-              inode_data_to_disk(temp_sector, disk_inode);
-              disk_write(filesys_disk, sector, temp_sector);
-              free(temp_sector);
-              success = true;
-          }
-          else {
-              disk_write(filesys_disk, disk_inode->double_indirect_idx, &single);
-              struct inode_disk *temp_sector = malloc(sizeof (struct inode_disk));
-              inode_data_to_disk(temp_sector, disk_inode);
-              disk_write(filesys_disk, sector, temp_sector);
-              free(temp_sector);
-              success = true;
-          }
-    } //end of 'else'
-    return success;
-}
-/* List of open inodes, so that opening a single inode twice
-   returns the same `struct inode'. */
-static struct list open_inodes;
+static hash_hash_func inode_hash;
+static hash_less_func inode_less;
+
+/* Open inodes with delayed sectors.  An inode is on the list
+   exactly when its delayed_cnt is nonzero.  Lock order is an
+   inode's rwlock, then delayed_lock; inode_flush_delayed() goes
+   the other way, but only tries the inode rwlocks.  delayed_lock
+   and an inode's rwlock may be held while taking
+   open_inodes_lock. */
+static struct list delayed_inodes;
+static struct lock delayed_lock;
 
 /* Initializes the inode module. */
 void
 inode_init (void) 
 {
-  list_init (&open_inodes);
+  if (!hash_init (&open_inodes, inode_hash, inode_less, NULL))
+    PANIC ("can't allocate open inode table");
+  lock_init (&open_inodes_lock);
+  list_init (&delayed_inodes);
+  lock_init (&delayed_lock);
+}
+
+/* Returns true if INODE's data sectors should be allocated when
+   written back rather than when written.  Directories and the free
+   map, which are read in place through the cache, are not. */
+static bool
+inode_delays_allocation (const struct inode *inode)
+{
+  return !inode->data.is_dir && inode->sector != FREE_MAP_SECTOR;
+}
+
+/* Gives all of INODE's delayed sectors their disk sectors, in one
+   batch placed after the data that precedes them, so that a file
+   written in small appends still ends up in long extents.  INODE's
+   rwlock must be held for writing and INODE must already be off
+   the delayed list. */
+static void
+inode_assign_delayed (struct inode *inode)
+{
+  struct sector_allocator sa;
+  size_t pos;
+
+  if (inode->delayed_cnt == 0)
+    return;
+
+  sector_alloc_init (&sa, alloc_goal (inode, inode->delayed_first) + 1,
+                     inode->delayed_cnt);
+  sa.wanted = inode->delayed_cnt;   /* Index blocks already exist. */
+  sa.reserved = true;
+  for (pos = inode->delayed_first; pos <= inode->delayed_last; pos++)
+    if (cache_is_delayed (inode_map_sector (inode, pos, NULL)))
+      inode_map_sector (inode, pos, &sa);
+  sector_alloc_done (&sa);
+
+  inode->delayed_cnt = 0;
+  inode_data_store (inode->sector, &inode->data);
+}
+
+/* Gives the delayed sectors of every open inode their disk
+   sectors.  If WAIT is false, an inode that is busy is skipped
+   until the next call.  If WAIT is true, each inode is waited for,
+   so that none is left with delayed sectors. */
+void
+inode_flush_delayed (bool wait)
+{
+  struct list_elem *e, *next;
+
+  if (wait)
+    {
+      /* Waiting on an inode's rwlock under delayed_lock would
+         invert the lock order, so keep the inode open instead
+         while delayed_lock is dropped. */
+      for (;;)
+        {
+          struct inode *inode;
+
+          lock_acquire (&delayed_lock);
+          if (list_empty (&delayed_inodes))
+            {
+              lock_release (&delayed_lock);
+              break;
+            }
+          inode = list_entry (list_front (&delayed_inodes),
+                              struct inode, delayed_elem);
+          inode_reopen (inode);
+          lock_release (&delayed_lock);
+
+          rwlock_acquire_write (&inode->rwlock);
+          if (inode->delayed_cnt > 0)
+            {
+              lock_acquire (&delayed_lock);
+              list_remove (&inode->delayed_elem);
+              lock_release (&delayed_lock);
+              inode_assign_delayed (inode);
+            }
+          rwlock_release_write (&inode->rwlock);
+          inode_close (inode);
+        }
+      return;
+    }
+
+  lock_acquire (&delayed_lock);
+  for (e = list_begin (&delayed_inodes); e != list_end (&delayed_inodes);
+       e = next)
+    {
+      struct inode *inode = list_entry (e, struct inode, delayed_elem);
+
+      next = list_next (e);
+      if (!rwlock_try_acquire_write (&inode->rwlock))
+        continue;
+      list_remove (e);
+      inode_assign_delayed (inode);
+      rwlock_release_write (&inode->rwlock);
+    }
+  lock_release (&delayed_lock);
 }
 
 /* Initializes an inode with LENGTH bytes of data and
@@ -524,7 +815,6 @@ bool
 inode_create (disk_sector_t sector, off_t length, bool is_dir)
 {
   struct inode_disk *disk_inode = NULL;
-  bool success = false;
 
   ASSERT (length >= 0);
 
@@ -532,18 +822,59 @@ inode_create (disk_sector_t sector, off_t length, bool is_dir)
      one sector in size, and you should fix that. */
   ASSERT (sizeof *disk_inode == DISK_SECTOR_SIZE);
 
-  disk_inode = calloc (1, sizeof *disk_inode);
-  if (disk_inode != NULL)
-    {
-      size_t sectors = bytes_to_sectors (length);
-      disk_inode->length = length;
-      disk_inode->magic = INODE_MAGIC;
-	  disk_inode->is_dir = is_dir;
-      success = alloc_sectors(disk_inode, sector, sectors);
+  /* All of the data starts out as a hole, so only the inode
+     itself is written.  Sectors are allocated as they are first
+     written.  A small regular file starts out with its data
+     inline instead.  Directories, whose sectors are read in place,
+     and the free map, which cannot allocate sectors for itself,
+     always use their index. */
+  disk_inode = cache_get_blank (sector);
+  disk_inode->length = length;
+  disk_inode->magic = INODE_MAGIC;
+  disk_inode->is_dir = is_dir;
+  disk_inode->is_inline = (!is_dir && sector != FREE_MAP_SECTOR
+                           && length <= INODE_INLINE_MAX);
+
+  /* New directories are hashed.  See directory.c. */
+  disk_inode->dir_hashed = is_dir;
+  cache_put (sector, true);
+  return true;
+}
+
+/* Returns a hash value for inode E. */
+static unsigned
+inode_hash (const struct hash_elem *e, void *aux UNUSED)
+{
+  return hash_int (hash_entry (e, struct inode, elem)->sector);
+}
 
-      free (disk_inode);
-    } //disk_inode != NULL
-  return success;
+/* Returns true if inode A precedes inode B. */
+static bool
+inode_less (const struct hash_elem *a_, const struct hash_elem *b_,
+            void *aux UNUSED)
+{
+  const struct inode *a = hash_entry (a_, struct inode, elem);
+  const struct inode *b = hash_entry (b_, struct inode, elem);
+
+  return a->sector < b->sector;
+}
+
+/* Returns the open inode for SECTOR with a new reference to it, or
+   a null pointer if it is not open.  Must be called with
+   open_inodes_lock held. */
+static struct inode *
+inode_find (disk_sector_t sector)
+{
+  struct inode key;
+  struct hash_elem *e;
+
+  key.sector = sector;
+  e = hash_find (&open_inodes, &key.elem);
+  if (e == NULL)
+    return NULL;
+  struct inode *inode = hash_entry (e, struct inode, elem);
+  inode->open_cnt++;
+  return inode;
 }
 
 /* Reads an inode from SECTOR
@@ -552,20 +883,14 @@ inode_create (disk_sector_t sector, off_t length, bool is_dir)
 struct inode *
 inode_open (disk_sector_t sector) 
 {
-  struct list_elem *e;
   struct inode *inode;
 
   /* Check whether this inode is already open. */
-  for (e = list_begin (&open_inodes); e != list_end (&open_inodes);
-       e = list_next (e)) 
-    {
-      inode = list_entry (e, struct inode, elem);
-      if (inode->sector == sector) 
-        {
-          inode_reopen (inode);
-          return inode; 
-        }
-    }
+  lock_acquire (&open_inodes_lock);
+  inode = inode_find (sector);
+  lock_release (&open_inodes_lock);
+  if (inode != NULL)
+    return inode;
 
   /* Allocate memory. */
   inode = malloc (sizeof *inode);
@@ -575,23 +900,36 @@ inode_open (disk_sector_t sector)
   }
 
   /* Initialize. */
-  list_push_front (&open_inodes, &inode->elem);
   inode->sector = sector;
   inode->open_cnt = 1;
   inode->deny_write_cnt = 0;
   //inode->writing_cnt = 0;
   inode->removed = false;
-  struct inode_disk *temp_disk = malloc(sizeof(struct inode_disk));
   //printf("copy\n");
-  disk_read (filesys_disk, inode->sector, temp_disk);
-  inode_disk_to_data(&inode->data, temp_disk);
-  free(temp_disk);
+  inode_disk_to_data(&inode->data, cache_get(inode->sector));
+  cache_put(inode->sector, false);
   //printf("copy end\n");
   //printf("inode_open\n");
   //printf("data copied well? %d\n", inode->data.length);
   
-  lock_init(&inode->lock);
+  rwlock_init(&inode->rwlock);
+  inode->delayed_cnt = 0;
+  inode->block_map = NULL;
+  lock_init(&inode->block_map_lock);
   //sema_init(&inode->sema, 0);
+
+  /* The inode was read without holding the table lock, so another
+     thread may have opened it meanwhile.  If so, use theirs. */
+  lock_acquire (&open_inodes_lock);
+  struct inode *other = inode_find (sector);
+  if (other == NULL)
+    hash_insert (&open_inodes, &inode->elem);
+  lock_release (&open_inodes_lock);
+  if (other != NULL)
+    {
+      free (inode);
+      return other;
+    }
   return inode;
 
 }
@@ -601,7 +939,11 @@ struct inode *
 inode_reopen (struct inode *inode)
 {
   if (inode != NULL)
-    inode->open_cnt++;
+    {
+      lock_acquire (&open_inodes_lock);
+      inode->open_cnt++;
+      lock_release (&open_inodes_lock);
+    }
   return inode;
 }
 
@@ -624,95 +966,65 @@ inode_close (struct inode *inode)
   if (inode == NULL)
     return;
 
+  /* Most closes are not the last and only drop the count. */
+  lock_acquire (&open_inodes_lock);
+  bool last = inode->open_cnt == 1;
+  if (!last)
+    inode->open_cnt--;
+  lock_release (&open_inodes_lock);
+  if (!last)
+    return;
+
+  /* Take it off the delayed list, and give its delayed sectors
+     their place on disk unless they are about to be freed, while
+     it is still in the open inode table, so that a thread opening
+     it meanwhile finds it rather than reading the inode from disk
+     before the assignment is stored.  Holding the rwlock keeps
+     such a thread from adding delayed sectors again before the
+     count is dropped. */
+  rwlock_acquire_write (&inode->rwlock);
+  if (inode->delayed_cnt > 0)
+    {
+      lock_acquire (&delayed_lock);
+      list_remove (&inode->delayed_elem);
+      lock_release (&delayed_lock);
+      if (!inode->removed)
+        inode_assign_delayed (inode);
+    }
+
   /* Release resources if this was the last opener. */
-  if (--inode->open_cnt == 0)
+  lock_acquire (&open_inodes_lock);
+  last = --inode->open_cnt == 0;
+  if (last)
+    hash_delete (&open_inodes, &inode->elem);
+  lock_release (&open_inodes_lock);
+  rwlock_release_write (&inode->rwlock);
+
+  if (last)
     {
-      /* Remove from inode list and release lock. */
-      list_remove (&inode->elem);
- 
       /* Deallocate blocks if removed. */
      if (inode->removed) 
         {
             //printf("Deallocate!\n");
             struct inode_data *disk_inode = &inode->data;
-            int length = inode->data.length;
-            int sectors = bytes_to_sectors (length);
-            int i, j;
-           /* CASE 1 */
-            if (sectors <= DIRECT_INDEX_RANGE) {
-                for (i = 0; i < sectors ; i++) {
-                    free_map_release(disk_inode->direct_idx[i], 1);
-                }
-            }
-           /* CASE 2 */
-            else if (sectors <= INDIRECT_INDEX_RANGE) {
-                for (i = 0 ; i < DIRECT_INDEX_SIZE ; i++ ) {
-                    free_map_release(disk_inode->direct_idx[i], 1);
-                }
-                int last_indirect_index = (sectors - DIRECT_INDEX_SIZE) / 128;
-                int last_indirect_block_index = (sectors - DIRECT_INDEX_SIZE) % 128;
-                struct indirect_block single;
-                
-                for (i = 0; i < last_indirect_index ; i++) {
-                    disk_read(filesys_disk, disk_inode->indirect_idx[i], &single);
-                    for (j = 0; j<128; j++) {
-                        free_map_release(single.entry[j], 1);
-                    }
-                    free_map_release(disk_inode->indirect_idx[i], 1);
-                }
-                if (last_indirect_block_index != 0) {
-                    disk_read(filesys_disk, disk_inode->indirect_idx[last_indirect_index], &single);
-                    for (i=0; i< last_indirect_block_index ; i++) {
-                        free_map_release(single.entry[i], 1);
-                    }
-                    free_map_release(disk_inode->indirect_idx[last_indirect_index], 1);
-                }
-
-            }
-
-            /* CASE 3 */
-            else {
-                for (i = 0 ; i < DIRECT_INDEX_SIZE ; i++) {
-                    free_map_release(disk_inode->direct_idx[i], 1);
-                }
-
-                struct indirect_block single;
-                struct indirect_block doubly;
-                for (i = 0; i < INDIRECT_INDEX_SIZE ; i++) {
-                    disk_read(filesys_disk, disk_inode->indirect_idx[i], &single);
-                    for (j = 0; j < 128; j++) {
-                        free_map_release(single.entry[j], 1);
-                    }
-                    free_map_release(disk_inode->indirect_idx[i], 1);
-                }
-
-                int first_level_index = (sectors - INDIRECT_INDEX_RANGE) / 128;
-                int second_level_index = (sectors - INDIRECT_INDEX_RANGE) % 128;
-                disk_read(filesys_disk, disk_inode->double_indirect_idx, &single);
-                for (i = 0; i < first_level_index; i++) {
-                    disk_read(filesys_disk, single.entry[i], &doubly);
-                    for (j = 0; j < 128; j++) {
-                        free_map_release(doubly.entry[j], 1);
-                    }
-                    free_map_release(single.entry[i], 1);
-                }
-
-                if (second_level_index != 0) {
-                    disk_read(filesys_disk, single.entry[first_level_index], &doubly);
-                    for (j=0; j<second_level_index; j++) {
-                        free_map_release(doubly.entry[j], 1);
-                    }
-                    free_map_release(single.entry[first_level_index], 1);
-                }
-                free_map_release(disk_inode->double_indirect_idx, 1);
-              
-
-            }
+            int i;
+
+            /* Holes are zero entries and have nothing to free. */
+            for (i = 0; i < DIRECT_INDEX_SIZE; i++)
+                if (disk_inode->direct_idx[i] != 0)
+                    release_sector(disk_inode->direct_idx[i]);
+            for (i = 0; i < INDIRECT_INDEX_SIZE; i++)
+                if (disk_inode->indirect_idx[i] != 0)
+                    free_index_block(disk_inode->indirect_idx[i], 1);
+            if (disk_inode->double_indirect_idx != 0)
+                free_index_block(disk_inode->double_indirect_idx, 2);
+            block_map_release_delayed (inode);
           free_map_release (inode->sector, 1);
           //free_map_release (inode->data.start,
                            // bytes_to_sectors (inode->data.length)); 
         }
 
+      block_map_free (inode);
       free (inode); 
     }
 }
@@ -729,7 +1041,8 @@ inode_remove (struct inode *inode)
 
 /* Reads SIZE bytes from INODE into BUFFER, starting at position OFFSET.
    Returns the number of bytes actually read, which may be less
-   than SIZE if an error occurs or end of file is reached. */
+   than SIZE if an error occurs or end of file is reached.
+   The caller may already hold INODE's rwlock for writing. */
 off_t
 inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset) 
 {
@@ -738,127 +1051,219 @@ inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset)
     //printf("inode_read_at\n");
   uint8_t *buffer = buffer_;
   off_t bytes_read = 0;
+  bool held = rwlock_held_for_write (&inode->rwlock);
 
-  
-
+  if (!held)
+    rwlock_acquire_read (&inode->rwlock);
+  if (inode->data.is_inline)
+    {
+      off_t inode_left = inode_length (inode) - offset;
+      if (size > inode_left)
+        size = inode_left;
+      if (size > 0)
+        {
+          memcpy (buffer, inode->data.inline_data + offset, size);
+          bytes_read = size;
+        }
+      size = 0;
+    }
   while (size > 0) 
   {
      /* if (inode->writing_cnt > 0) {
           sema_down(&inode->sema);
           }*/
-      if(offset > inode->data.length)
-          return bytes_read;
-      /* Disk sector to read, starting byte offset within sector. */
-      disk_sector_t sector_idx = byte_to_sector_indexed (inode, offset, inode->data.length);
-      //printf("sector_idx : %d\n", sector_idx);
-      int sector_ofs = offset % DISK_SECTOR_SIZE;
-
-      /* Bytes left in inode, bytes left in sector, lesser of the two. */
+      /* Bytes left in inode, lesser of that and SIZE. */
       off_t inode_left = inode_length (inode) - offset;
-      int sector_left = DISK_SECTOR_SIZE - sector_ofs;
-      int min_left = inode_left < sector_left ? inode_left : sector_left;
-
-      /* Number of bytes to actually copy out of this sector. */
-      int chunk_size = size < min_left ? size : min_left;
-      if (chunk_size <= 0)
+      off_t want = size < inode_left ? size : inode_left;
+      if (want <= 0)
         break;
 
-      read_in_cache(sector_idx, sector_ofs, buffer + bytes_read, chunk_size);      
+      /* Run of sectors to read, starting byte offset within the
+         first. */
+      int sector_ofs = offset % DISK_SECTOR_SIZE;
+      disk_sector_t sector_idx;
+      size_t cnt = inode_map_run (inode, byte_to_sector (offset),
+                                  bytes_to_sectors (sector_ofs + want),
+                                  &sector_idx);
+      //printf("sector_idx : %d\n", sector_idx);
+
+      /* Number of bytes to actually copy out of this run. */
+      off_t chunk_size = (off_t) cnt * DISK_SECTOR_SIZE - sector_ofs;
+      if (chunk_size > want)
+        chunk_size = want;
+
+      if (sector_idx == 0)
+        memset (buffer + bytes_read, 0, chunk_size);    /* Holes. */
+      else
+        cache_read_run (sector_idx, sector_ofs, buffer + bytes_read, chunk_size);
       /* Advance. */
       size -= chunk_size;
       offset += chunk_size;
       bytes_read += chunk_size;
     }
-
+  if (!held)
+    rwlock_release_read (&inode->rwlock);
   return bytes_read;
 }
 
+/* Queues the sectors holding bytes OFFSET through OFFSET + SIZE
+   of INODE for read-ahead, stopping at end of file.  Sectors are
+   only looked up through index blocks already in INODE's block
+   map, so that read-ahead never makes the caller wait for an
+   index block; the window stops short at the first one that is
+   not, and a later call picks up from there once the foreground
+   read has brought it in.
+   Returns the number of bytes past OFFSET that were dealt with,
+   which is SIZE unless the window stopped short. */
+off_t
+inode_read_ahead (struct inode *inode, off_t offset, off_t size)
+{
+  off_t length;
+  off_t pos;
+
+  rwlock_acquire_read (&inode->rwlock);
+  length = inode->data.is_inline ? 0 : inode_length (inode);
+  for (pos = offset - offset % DISK_SECTOR_SIZE;
+       pos < offset + size && pos < length; pos += DISK_SECTOR_SIZE)
+    {
+      disk_sector_t sector;
+
+      if (!inode_peek_sector (inode, byte_to_sector (pos), &sector))
+        {
+          rwlock_release_read (&inode->rwlock);
+          return pos > offset ? pos - offset : 0;
+        }
+      if (sector != 0)
+        cache_read_ahead (sector);
+    }
+  rwlock_release_read (&inode->rwlock);
+  return size;
+}
+
 /* Writes SIZE bytes from BUFFER into INODE, starting at OFFSET.
    Returns the number of bytes actually written, which may be
    less than SIZE if end of file is reached or an error occurs.
-   (Normally a write at end of file would extend the inode, but
-   growth is not yet implemented.) */
+   Writes that only overwrite existing data share INODE's rwlock
+   with readers and other such writers; a write that extends
+   INODE or fills a hole in it holds the rwlock for writing.  The
+   caller may already hold it for writing, as directory.c does
+   while changing a directory's entries. */
 off_t
 inode_write_at (struct inode *inode, const void *buffer_, off_t size,
                 off_t offset) 
 {
-
-      //inode->writing_cnt++;
   const uint8_t *buffer = buffer_;
   off_t bytes_written = 0;
+  struct sector_allocator sa;
+  bool allocating = false;      /* SA set up? */
+  bool changed = false;         /* Inode needs writing back? */
 
   if (inode->deny_write_cnt)
     return 0;
 
   bool grow = (inode->data.length < offset+size);
-  int newlength = offset+size;
+  bool held = rwlock_held_for_write (&inode->rwlock);
+  bool exclusive = grow || held;    /* Holding the rwlock for writing? */
 
-  if (grow) {
+  if (held)
+    {
+      /* The caller's hold covers everything below. */
+    }
+  else if (grow) {
       //printf("grow\n");
-      lock_acquire(&inode->lock);
+      rwlock_acquire_write(&inode->rwlock);
   }
+  else
+    rwlock_acquire_read(&inode->rwlock);
 
-  while (size > 0) 
+  /* Inline data is part of the inode, so it is only ever written
+     under the write lock.  A write that does not fit moves it out
+     to a sector first. */
+  if (inode->data.is_inline) 
     {
-      /* Sector to write, starting byte offset within sector. */
-      disk_sector_t sector_idx = byte_to_sector_indexed (inode, offset, inode->data.length);
-      //printf("@SECTOR %d\n", sector_idx);
-
-      if (sector_idx == -1) {   //File grow
-          int grow_bytes = offset+size - inode->data.length;
-          if (grow_bytes > 0) {
-              //lock_acquire(&(inode->lock));
-              int sectors = bytes_to_sectors (offset + size);
-              //printf("now %d grow to %d : allocate %d\n", inode_length(inode), offset+size, sectors);
-
-              alloc_sectors_grow(inode, inode->sector, sectors, newlength);
-              sector_idx = byte_to_sector_indexed (inode, offset,newlength);
-              //printf("new sector_idx : %d\n", sector_idx);
-              //lock_release(&(inode->lock));
-          }
-      }
-      //printf("*** write to sector %d [offset : %d, size : %d]\n", sector_idx, offset, size);
-
+      if (!exclusive) 
+        {
+          rwlock_release_read(&inode->rwlock);
+          rwlock_acquire_write(&inode->rwlock);
+          exclusive = true;
+        }
+      if (inode->data.is_inline && offset + size <= INODE_INLINE_MAX) 
+        {
+          memcpy (inode->data.inline_data + offset, buffer, size);
+          offset += size;
+          bytes_written = size;
+          size = 0;
+          changed = true;
+        }
+      else if (inode->data.is_inline) 
+        {
+          if (inode_uninline (inode))
+            changed = true;
+          else
+            size = 0;
+        }
+    }
 
+  while (size > 0) 
+    {
+      /* Run of sectors to write, starting byte offset within the
+         first. */
+      size_t sector_pos = byte_to_sector (offset);
       int sector_ofs = offset % DISK_SECTOR_SIZE;
+      size_t want = bytes_to_sectors (sector_ofs + size);
+      disk_sector_t sector_idx;
+      size_t cnt = inode_map_run (inode, sector_pos, want, &sector_idx);
 
-      /* Bytes left in inode, bytes left in sector, lesser of the two. */
-      //off_t inode_left = inode_length (inode) - offset;
-      int sector_left = DISK_SECTOR_SIZE - sector_ofs;
-      //int min_left = inode_left < sector_left ? inode_left : sector_left;
-
-      /* Number of bytes to actually write into this sector. */
-      int chunk_size = size < sector_left ? size : sector_left;
-      if (chunk_size <= 0)
-        break;
-
-      if (sector_ofs == 0 && chunk_size == DISK_SECTOR_SIZE) 
+      /* Filling a hole needs the rwlock for writing.  It cannot be
+         upgraded in place, so look again once we have it. */
+      if (!exclusive && sector_idx == 0) 
         {
-          /* Write full sector directly to disk. */
-          write_to_cache (sector_idx, 0, buffer + bytes_written, DISK_SECTOR_SIZE, false);
+          rwlock_release_read(&inode->rwlock);
+          rwlock_acquire_write(&inode->rwlock);
+          exclusive = true;
+          cnt = inode_map_run (inode, sector_pos, want, &sector_idx);
         }
-      else 
+
+      if (sector_idx == 0) 
         {
-            //printf("write : chunk_size %d, sector_idx %d\n", chunk_size, sector_idx);
-          /* We don't need a bounce buffer anymore. */
-
-          /* If the sector contains data before or after the chunk
-             we're writing, then we need to read in the sector
-             first.  Otherwise we start with a sector of all zeros. */
-          if (sector_ofs > 0 || chunk_size < sector_left) 
-            write_to_cache(sector_idx, sector_ofs, buffer + bytes_written, chunk_size, true);
-          else
-            write_to_cache(sector_idx, sector_ofs, buffer + bytes_written, chunk_size, false);
+          /* Holes are filled one sector at a time. */
+          cnt = 1;
+          /* A hole, either inside the file or past its end.  The
+             first one reserves an extent for the rest of the
+             write. */
+          if (!allocating) 
+            {
+              sector_alloc_init (&sa, alloc_goal (inode, sector_pos) + 1,
+                                 bytes_to_sectors (sector_ofs + size));
+              sa.delay = inode_delays_allocation (inode);
+              allocating = true;
+            }
+          sector_idx = inode_map_sector (inode, sector_pos, &sa);
+          if (sector_idx == 0)
+            break;
+          if (cache_is_delayed (sector_idx)) 
+            {
+              if (inode->delayed_cnt++ == 0) 
+                {
+                  inode->delayed_first = inode->delayed_last = sector_pos;
+                  lock_acquire (&delayed_lock);
+                  list_push_back (&delayed_inodes, &inode->delayed_elem);
+                  lock_release (&delayed_lock);
+                }
+              else if (sector_pos < inode->delayed_first)
+                inode->delayed_first = sector_pos;
+              else if (sector_pos > inode->delayed_last)
+                inode->delayed_last = sector_pos;
+            }
         }
+      //printf("*** write to sector %d [offset : %d, size : %d]\n", sector_idx, offset, size);
+
+      /* Number of bytes to actually write into this run. */
+      off_t chunk_size = (off_t) cnt * DISK_SECTOR_SIZE - sector_ofs;
+      if (chunk_size > size)
+        chunk_size = size;
 
-      /* Update length */
-      if (inode_length(inode) < offset + chunk_size) {
-          inode->data.length = offset + chunk_size;
-          struct inode_disk *temp_disk = malloc(sizeof (struct inode_disk));
-          inode_data_to_disk(temp_disk, &inode->data);
-          disk_write(filesys_disk, inode->sector, temp_disk);
-          free(temp_disk);
-      }
+      cache_write_run (sector_idx, sector_ofs, buffer + bytes_written, chunk_size);
 
       /* Advance. */
       size -= chunk_size;
@@ -866,14 +1271,27 @@ inode_write_at (struct inode *inode, const void *buffer_, off_t size,
       bytes_written += chunk_size;
     }
 
-  /*if (inode->writing_cnt-- == 1) {
-      // Last writing thread should wake up reading thread 
-      if (!list_empty(&inode->sema.waiters))
-        sema_up(&inode->sema);
-  }*/
+  if (allocating)
+    sector_alloc_done (&sa);
 
-  if (grow)
-      lock_release(&inode->lock);
+  /* Update length, and write back the inode if it or its index
+     changed. */
+  changed = changed || allocating;
+  if (inode_length (inode) < offset)
+    {
+      inode->data.length = offset;
+      changed = true;
+    }
+  if (changed)
+    inode_data_store (inode->sector, &inode->data);
+
+  if (!held)
+    {
+      if (exclusive)
+        rwlock_release_write (&inode->rwlock);
+      else
+        rwlock_release_read (&inode->rwlock);
+    }
 
   return bytes_written;
 }
@@ -5,7 +5,12 @@
 #include "filesys/off_t.h"
 #include "devices/disk.h"
 #include "threads/thread.h"
+#include "threads/synch.h"
 #include <list.h>
+#include <hash.h>
+
+/* Number of data bytes that fit in the inode itself. */
+#define INODE_INLINE_MAX 440
 
 struct inode_disk 
 {
@@ -18,9 +23,13 @@ struct inode_disk
     
     /* used if directory */
 	bool is_dir;
+    bool is_inline;             /* Data kept in INLINE_DATA? */
+    bool dir_hashed;            /* Directory in hashed format? */
     disk_sector_t parent;
 
-	uint32_t unused[110];
+    /* The data of a small file, if IS_INLINE.  Its index is then
+       unused. */
+	uint8_t inline_data[INODE_INLINE_MAX];
 };
 
 struct inode_data
@@ -31,15 +40,18 @@ struct inode_data
     disk_sector_t indirect_idx[4];
     disk_sector_t double_indirect_idx;
     bool is_dir;
+    bool is_inline;
+    bool dir_hashed;
     disk_sector_t parent;
+    uint8_t inline_data[INODE_INLINE_MAX];
 };
 
 
 struct inode
 {
-	struct list_elem elem;
+	struct hash_elem elem;          /* Element in open inode table. */
 	disk_sector_t sector;
-	int open_cnt;
+	int open_cnt;                   /* Guarded by open_inodes_lock. */
 
     /* Reading Thread should wait for writing thread to finish up */
     //struct semaphore sema;
@@ -49,7 +61,23 @@ struct inode
 	int deny_write_cnt;
 	struct inode_data data;
 
-    struct lock lock;
+    /* Held for reading while the data is read or overwritten in
+       place, and for writing while the length or the index
+       changes. */
+    struct rwlock rwlock;
+
+    /* Delayed sectors in the data, not yet assigned disk sectors.
+       All lie between data sectors DELAYED_FIRST and DELAYED_LAST.
+       Guarded by RWLOCK, held for writing. */
+    struct list_elem delayed_elem;  /* Element in delayed inode list. */
+    size_t delayed_cnt;
+    size_t delayed_first, delayed_last;
+
+    /* In-memory copies of the index blocks that map the data past
+       the direct entries, read in on first use and updated along
+       with them.  A table of pointers to copies, or null. */
+    disk_sector_t **block_map;
+    struct lock block_map_lock;     /* Guards installing copies. */
 };
 
 struct bitmap;
@@ -61,10 +89,13 @@ struct inode *inode_reopen (struct inode *);
 disk_sector_t inode_get_inumber (const struct inode *);
 void inode_close (struct inode *);
 void inode_remove (struct inode *);
+disk_sector_t byte_to_sector_indexed (struct inode *, off_t pos, int length);
 off_t inode_read_at (struct inode *, void *, off_t size, off_t offset);
 off_t inode_write_at (struct inode *, const void *, off_t size, off_t offset);
+off_t inode_read_ahead (struct inode *, off_t offset, off_t size);
 void inode_deny_write (struct inode *);
 void inode_allow_write (struct inode *);
 off_t inode_length (const struct inode *);
+void inode_flush_delayed (bool wait);
 
 #endif /* filesys/inode.h */
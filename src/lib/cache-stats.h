@@ -0,0 +1,19 @@
+#ifndef __LIB_CACHE_STATS_H
+#define __LIB_CACHE_STATS_H
+
+/* Buffer cache counters, filled in by the cachestat system
+   call. */
+struct cache_stats
+  {
+    long long hits;                 /* Lookups satisfied by the cache. */
+    long long misses;               /* Lookups that went to disk. */
+    long long evictions;            /* Valid sectors evicted. */
+    long long dirty_evictions;      /* ...that had to be written back. */
+    long long read_ahead_issued;    /* Sectors loaded by read-ahead. */
+    long long read_ahead_used;      /* ...later hit by a real access. */
+    long long read_ahead_wasted;    /* ...evicted without being used. */
+    long long write_back_batches;   /* Multi-sector write-back transfers. */
+    long long write_back_sectors;   /* Sectors written by those transfers. */
+  };
+
+#endif /* lib/cache-stats.h */
@@ -0,0 +1,18 @@
+#ifndef __LIB_DIRENT_H
+#define __LIB_DIRENT_H
+
+#include <stdbool.h>
+
+/* Maximum characters in a filename written by readdir() and
+   getdents(). */
+#define READDIR_MAX_LEN 14
+
+/* A directory entry, as written by the getdents system call. */
+struct dirent
+  {
+    int inumber;                    /* Inode number of the entry. */
+    bool is_dir;                    /* Is it a directory? */
+    char name[READDIR_MAX_LEN + 1]; /* Null terminated file name. */
+  };
+
+#endif /* lib/dirent.h */
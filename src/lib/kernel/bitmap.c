@@ -28,6 +28,7 @@ struct bitmap
   {
     size_t bit_cnt;     /* Number of bits. */
     elem_type *bits;    /* Elements that represent bits. */
+    size_t hint;        /* Where bitmap_scan_and_flip_next() starts. */
   };
 
 /* Returns the index of the element that contains the bit
@@ -60,6 +61,35 @@ byte_cnt (size_t bit_cnt)
   return sizeof (elem_type) * elem_cnt (bit_cnt);
 }
 
+/* Returns the index of the first bit in B at or after START and
+   before END that is set to VALUE, or END if there is none.
+   Elements that cannot contain such a bit are skipped whole, and
+   the bit within an element is found with the processor's
+   bit-scan instruction. */
+static size_t
+find_bit (const struct bitmap *b, size_t start, size_t end, bool value)
+{
+  elem_type flip = value ? 0 : (elem_type) -1;
+  size_t idx, bit;
+  elem_type e;
+
+  if (start >= end)
+    return end;
+
+  /* Ignore the bits of the first element below START. */
+  idx = elem_idx (start);
+  e = (b->bits[idx] ^ flip) & ~(bit_mask (start) - 1);
+  while (e == 0)
+    {
+      if (++idx * ELEM_BITS >= end)
+        return end;
+      e = b->bits[idx] ^ flip;
+    }
+
+  bit = idx * ELEM_BITS + __builtin_ctzl (e);
+  return bit < end ? bit : end;
+}
+
 /* Returns a bit mask in which the bits actually used in the last
    element of B's bits are set to 1 and the rest are set to 0. */
 static inline elem_type
@@ -83,6 +113,7 @@ bitmap_create (size_t bit_cnt)
     {
       b->bit_cnt = bit_cnt;
       b->bits = malloc (byte_cnt (bit_cnt));
+      b->hint = 0;
       if (b->bits != NULL || bit_cnt == 0)
         {
           bitmap_set_all (b, false);
@@ -105,6 +136,7 @@ bitmap_create_in_buf (size_t bit_cnt, void *block, size_t block_size UNUSED)
 
   b->bit_cnt = bit_cnt;
   b->bits = (elem_type *) (b + 1);
+  b->hint = 0;
   bitmap_set_all (b, false);
   return b;
 }
@@ -218,14 +250,29 @@ bitmap_set_all (struct bitmap *b, bool value)
 void
 bitmap_set_multiple (struct bitmap *b, size_t start, size_t cnt, bool value) 
 {
-  size_t i;
+  size_t end = start + cnt;
   
   ASSERT (b != NULL);
   ASSERT (start <= b->bit_cnt);
   ASSERT (start + cnt <= b->bit_cnt);
 
-  for (i = 0; i < cnt; i++)
-    bitmap_set (b, start + i, value);
+  /* Set the bits an element at a time, each element atomically
+     as in bitmap_mark() and bitmap_reset(). */
+  while (start < end)
+    {
+      size_t idx = elem_idx (start);
+      size_t ofs = start % ELEM_BITS;
+      size_t bits = ELEM_BITS - ofs < end - start ? ELEM_BITS - ofs : end - start;
+      elem_type mask = (bits == ELEM_BITS
+                        ? (elem_type) -1
+                        : (((elem_type) 1 << bits) - 1) << ofs);
+
+      if (value)
+        asm ("orl %1, %0" : "=m" (b->bits[idx]) : "r" (mask) : "cc");
+      else
+        asm ("andl %1, %0" : "=m" (b->bits[idx]) : "r" (~mask) : "cc");
+      start += bits;
+    }
 }
 
 /* Returns the number of bits in B between START and START + CNT,
@@ -251,16 +298,11 @@ bitmap_count (const struct bitmap *b, size_t start, size_t cnt, bool value)
 bool
 bitmap_contains (const struct bitmap *b, size_t start, size_t cnt, bool value) 
 {
-  size_t i;
-  
   ASSERT (b != NULL);
   ASSERT (start <= b->bit_cnt);
   ASSERT (start + cnt <= b->bit_cnt);
 
-  for (i = 0; i < cnt; i++)
-    if (bitmap_test (b, start + i) == value)
-      return true;
-  return false;
+  return find_bit (b, start, start + cnt, value) < start + cnt;
 }
 
 /* Returns true if any bits in B between START and START + CNT,
@@ -299,13 +341,22 @@ bitmap_scan (const struct bitmap *b, size_t start, size_t cnt, bool value)
   ASSERT (b != NULL);
   ASSERT (start <= b->bit_cnt);
 
+  if (cnt == 0)
+    return start;
   if (cnt <= b->bit_cnt) 
     {
       size_t last = b->bit_cnt - cnt;
-      size_t i;
-      for (i = start; i <= last; i++)
-        if (!bitmap_contains (b, i, cnt, !value))
-          return i; 
+      size_t i = start;
+
+      /* Jump to the next bit set to VALUE, then to the end of its
+         run; the group fits if the run is CNT bits long. */
+      while ((i = find_bit (b, i, last + 1, value)) <= last)
+        {
+          size_t end = find_bit (b, i, i + cnt, !value);
+          if (end == i + cnt)
+            return i;
+          i = end;
+        }
     }
   return BITMAP_ERROR;
 }
@@ -326,6 +377,26 @@ bitmap_scan_and_flip (struct bitmap *b, size_t start, size_t cnt, bool value)
   return idx;
 }
 
+/* Like bitmap_scan_and_flip(), but searches next-fit: from just
+   past the group found by the previous call, wrapping around to
+   the beginning of B, so that repeated allocations do not rescan
+   the bits already taken. */
+size_t
+bitmap_scan_and_flip_next (struct bitmap *b, size_t cnt, bool value)
+{
+  size_t start = b->hint <= b->bit_cnt ? b->hint : 0;
+  size_t idx = bitmap_scan (b, start, cnt, value);
+
+  if (idx == BITMAP_ERROR && start > 0)
+    idx = bitmap_scan (b, 0, cnt, value);
+  if (idx != BITMAP_ERROR)
+    {
+      bitmap_set_multiple (b, idx, cnt, !value);
+      b->hint = idx + cnt;
+    }
+  return idx;
+}
+
 /* File input and output. */
 
 #ifdef FILESYS
@@ -359,6 +430,23 @@ bitmap_write (const struct bitmap *b, struct file *file)
   off_t size = byte_cnt (b->bit_cnt);
   return file_write_at (file, b->bits, size, 0) == size;
 }
+
+/* Writes the SIZE bytes of B that are stored at byte offset OFS
+   in FILE, clipped to the end of B.  Return true if successful,
+   false otherwise. */
+bool
+bitmap_write_range (const struct bitmap *b, struct file *file,
+                    off_t ofs, off_t size)
+{
+  off_t file_size = byte_cnt (b->bit_cnt);
+
+  ASSERT (ofs >= 0 && size >= 0);
+  if (ofs >= file_size)
+    return true;
+  if (size > file_size - ofs)
+    size = file_size - ofs;
+  return file_write_at (file, (uint8_t *) b->bits + ofs, size, ofs) == size;
+}
 #endif /* FILESYS */
 
 /* Debugging. */
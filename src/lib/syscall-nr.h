@@ -28,7 +28,13 @@ enum
     SYS_MKDIR,                  /* Create a directory. */
     SYS_READDIR,                /* Reads a directory entry. */
     SYS_ISDIR,                  /* Tests if a fd represents a directory. */
-    SYS_INUMBER                 /* Returns the inode number for a fd. */
+    SYS_INUMBER,                /* Returns the inode number for a fd. */
+
+    /* Buffer cache statistics. */
+    SYS_CACHESTAT,              /* Reads buffer cache counters. */
+
+    /* Batched directory reading. */
+    SYS_GETDENTS                /* Reads many directory entries. */
   };
 
 #endif /* lib/syscall-nr.h */
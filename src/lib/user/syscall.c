@@ -182,3 +182,15 @@ inumber (int fd)
 {
   return syscall1 (SYS_INUMBER, fd);
 }
+
+int
+getdents (int fd, struct dirent *entries, unsigned cnt) 
+{
+  return syscall3 (SYS_GETDENTS, fd, entries, cnt);
+}
+
+bool
+cachestat (struct cache_stats *stats)
+{
+  return syscall1 (SYS_CACHESTAT, stats);
+}
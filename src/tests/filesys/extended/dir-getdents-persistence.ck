@@ -0,0 +1,9 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+my ($fs);
+$fs->{'x'}{"f$_"} = [''] foreach 0...23;
+$fs->{'x'}{"d$_"} = {} foreach 0...15;
+check_archive ($fs);
+pass;
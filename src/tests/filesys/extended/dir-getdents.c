@@ -0,0 +1,75 @@
+/* Fills a directory with more entries than one of its buckets
+   holds, files and subdirectories alike, and checks that
+   getdents() returns each of them exactly once, with the right
+   is_dir flag, when read a few entries at a time. */
+
+#include <dirent.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define FILE_CNT 24
+#define DIR_CNT 16
+
+void
+test_main (void) 
+{
+  bool seen_file[FILE_CNT];
+  bool seen_dir[DIR_CNT];
+  struct dirent entries[7];
+  size_t total = 0;
+  char name[16];
+  size_t i;
+  int fd, cnt;
+
+  CHECK (mkdir ("x"), "mkdir \"x\"");
+  msg ("creating %d files and %d directories in \"x\"", FILE_CNT, DIR_CNT);
+  for (i = 0; i < FILE_CNT; i++) 
+    {
+      snprintf (name, sizeof name, "x/f%zu", i);
+      if (!create (name, 0))
+        fail ("create \"%s\"", name);
+    }
+  for (i = 0; i < DIR_CNT; i++) 
+    {
+      snprintf (name, sizeof name, "x/d%zu", i);
+      if (!mkdir (name))
+        fail ("mkdir \"%s\"", name);
+    }
+
+  memset (seen_file, 0, sizeof seen_file);
+  memset (seen_dir, 0, sizeof seen_dir);
+  CHECK ((fd = open ("x")) > 1, "open \"x\"");
+  msg ("read \"x\" with getdents");
+  while ((cnt = getdents (fd, entries, sizeof entries / sizeof *entries)) > 0)
+    for (i = 0; i < (size_t) cnt; i++) 
+      {
+        const struct dirent *d = &entries[i];
+        char kind = d->name[0];
+        int n = atoi (d->name + 1);
+        bool *seen;
+
+        /* Accept only the names made above, spelled as made. */
+        snprintf (name, sizeof name, "%c%d", kind, n);
+        if (strcmp (name, d->name) || n < 0
+            || (kind == 'f' ? n >= FILE_CNT : kind != 'd' || n >= DIR_CNT))
+          fail ("getdents returned unexpected entry \"%s\"", d->name);
+        if (d->is_dir != (kind == 'd'))
+          fail ("\"%s\" has is_dir %d", d->name, d->is_dir);
+        seen = kind == 'f' ? &seen_file[n] : &seen_dir[n];
+        if (*seen)
+          fail ("getdents returned \"%s\" twice", d->name);
+        *seen = true;
+        total++;
+      }
+  if (cnt < 0)
+    fail ("getdents failed");
+  if (total != FILE_CNT + DIR_CNT)
+    fail ("getdents returned %zu entries, expected %d",
+          total, FILE_CNT + DIR_CNT);
+  msg ("close \"x\"");
+  close (fd);
+}
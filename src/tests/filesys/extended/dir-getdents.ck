@@ -0,0 +1,14 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(dir-getdents) begin
+(dir-getdents) mkdir "x"
+(dir-getdents) creating 24 files and 16 directories in "x"
+(dir-getdents) open "x"
+(dir-getdents) read "x" with getdents
+(dir-getdents) close "x"
+(dir-getdents) end
+EOF
+pass;
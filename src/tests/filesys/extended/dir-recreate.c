@@ -0,0 +1,53 @@
+/* Looks up a file, removes it, and creates a new file and then a
+   directory under the same name, checking after each step that
+   opening the name reaches the new inode, not the one it named
+   before. */
+
+#include <random.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+static char buf1[100];
+static char buf2[600];
+
+void
+test_main (void) 
+{
+  int fd1, fd2;
+
+  random_bytes (buf1, sizeof buf1);
+  random_bytes (buf2, sizeof buf2);
+
+  CHECK (mkdir ("d"), "mkdir \"d\"");
+  CHECK (create ("d/a", 0), "create \"d/a\"");
+  CHECK ((fd1 = open ("d/a")) > 1, "open \"d/a\"");
+  CHECK (write (fd1, buf1, sizeof buf1) == sizeof buf1, "write \"d/a\"");
+  check_file ("d/a", buf1, sizeof buf1);
+
+  /* Keep the old file open, so that its sector cannot be handed
+     to the new one. */
+  CHECK (remove ("d/a"), "remove \"d/a\"");
+  CHECK (open ("d/a") == -1, "open \"d/a\" (must return -1)");
+  CHECK (create ("d/a", 0), "create \"d/a\" again");
+  CHECK ((fd2 = open ("d/a")) > 1, "open \"d/a\" again");
+  CHECK (inumber (fd1) != inumber (fd2),
+         "inumber of new \"d/a\" differs from old");
+  CHECK (write (fd2, buf2, sizeof buf2) == sizeof buf2, "write \"d/a\"");
+  msg ("close \"d/a\"");
+  close (fd2);
+  check_file ("d/a", buf2, sizeof buf2);
+  seek (fd1, 0);
+  check_file_handle (fd1, "d/a", buf1, sizeof buf1);
+  msg ("close old \"d/a\"");
+  close (fd1);
+
+  /* Now replace the file by a directory. */
+  CHECK (remove ("d/a"), "remove \"d/a\"");
+  CHECK (mkdir ("d/a"), "mkdir \"d/a\"");
+  CHECK (create ("d/a/b", 0), "create \"d/a/b\"");
+  CHECK ((fd1 = open ("d/a")) > 1, "open \"d/a\"");
+  CHECK (isdir (fd1), "isdir \"d/a\"");
+  msg ("close \"d/a\"");
+  close (fd1);
+}
@@ -0,0 +1,34 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(dir-recreate) begin
+(dir-recreate) mkdir "d"
+(dir-recreate) create "d/a"
+(dir-recreate) open "d/a"
+(dir-recreate) write "d/a"
+(dir-recreate) open "d/a" for verification
+(dir-recreate) verified contents of "d/a"
+(dir-recreate) close "d/a"
+(dir-recreate) remove "d/a"
+(dir-recreate) open "d/a" (must return -1)
+(dir-recreate) create "d/a" again
+(dir-recreate) open "d/a" again
+(dir-recreate) inumber of new "d/a" differs from old
+(dir-recreate) write "d/a"
+(dir-recreate) close "d/a"
+(dir-recreate) open "d/a" for verification
+(dir-recreate) verified contents of "d/a"
+(dir-recreate) close "d/a"
+(dir-recreate) verified contents of "d/a"
+(dir-recreate) close old "d/a"
+(dir-recreate) remove "d/a"
+(dir-recreate) mkdir "d/a"
+(dir-recreate) create "d/a/b"
+(dir-recreate) open "d/a"
+(dir-recreate) isdir "d/a"
+(dir-recreate) close "d/a"
+(dir-recreate) end
+EOF
+pass;
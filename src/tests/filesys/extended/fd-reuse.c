@@ -0,0 +1,55 @@
+/* Opens one file more times than a process's descriptor table
+   holds at first, so that the table must grow, then closes two
+   descriptors, one from before the growth and one from after, and
+   checks that opening the file again hands them back lowest
+   first. */
+
+#include <random.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define FD_CNT 40
+
+static char buf[64];
+
+void
+test_main (void) 
+{
+  int fds[FD_CNT];
+  int fd;
+  size_t i;
+
+  random_bytes (buf, sizeof buf);
+  CHECK (create ("data", sizeof buf), "create \"data\"");
+  CHECK ((fd = open ("data")) > 1, "open \"data\"");
+  CHECK (write (fd, buf, sizeof buf) == sizeof buf, "write \"data\"");
+  msg ("close \"data\"");
+  close (fd);
+
+  msg ("open \"data\" %d times", FD_CNT);
+  for (i = 0; i < FD_CNT; i++)
+    {
+      fds[i] = open ("data");
+      if (fds[i] < 2)
+        fail ("open #%zu of \"data\" returned %d", i, fds[i]);
+      if (i > 0 && fds[i] != fds[i - 1] + 1)
+        fail ("open #%zu of \"data\" returned %d, not lowest free %d",
+              i, fds[i], fds[i - 1] + 1);
+    }
+
+  quiet = true;
+  for (i = 0; i < FD_CNT; i++)
+    check_file_handle (fds[i], "data", buf, sizeof buf);
+  quiet = false;
+  msg ("verified contents through each descriptor");
+
+  msg ("close one descriptor from before the growth and one after");
+  close (fds[20]);
+  close (fds[5]);
+  CHECK ((fd = open ("data")) == fds[5], "reopen \"data\" gets lower one");
+  CHECK (open ("data") == fds[20], "reopen \"data\" gets higher one");
+  CHECK (open ("data") == fds[FD_CNT - 1] + 1,
+         "reopen \"data\" gets next new one");
+  check_file_handle (fd, "data", buf, sizeof buf);
+}
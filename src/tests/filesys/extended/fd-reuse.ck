@@ -0,0 +1,20 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(fd-reuse) begin
+(fd-reuse) create "data"
+(fd-reuse) open "data"
+(fd-reuse) write "data"
+(fd-reuse) close "data"
+(fd-reuse) open "data" 40 times
+(fd-reuse) verified contents through each descriptor
+(fd-reuse) close one descriptor from before the growth and one after
+(fd-reuse) reopen "data" gets lower one
+(fd-reuse) reopen "data" gets higher one
+(fd-reuse) reopen "data" gets next new one
+(fd-reuse) verified contents of "data"
+(fd-reuse) end
+EOF
+pass;
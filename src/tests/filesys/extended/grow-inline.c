@@ -0,0 +1,38 @@
+/* Grows a file from 0 bytes to 1,000 bytes, 130 bytes at a time,
+   so that one write carries it past the data that fits inside its
+   inode.  After each write, reads back everything written so far,
+   to check that the inline bytes survive the move to a data
+   sector. */
+
+#include <syscall.h>
+#include "tests/filesys/seq-test.h"
+#include "tests/lib.h"
+#include "tests/main.h"
+
+static char buf[1000];
+
+static size_t
+return_block_size (void) 
+{
+  return 130;
+}
+
+static void
+check_prefix (int fd, long ofs) 
+{
+  static char block[sizeof buf];
+
+  seek (fd, 0);
+  if (read (fd, block, ofs) != ofs)
+    fail ("read %ld bytes at offset 0 in \"testme\" failed", ofs);
+  compare_bytes (block, buf, ofs, 0, "testme");
+  seek (fd, ofs);
+}
+
+void
+test_main (void) 
+{
+  seq_test ("testme",
+            buf, sizeof buf, 0,
+            return_block_size, check_prefix);
+}
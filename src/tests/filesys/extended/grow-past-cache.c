@@ -0,0 +1,22 @@
+/* Grows a file from 0 bytes to 150,000 bytes, 40,000 bytes at a
+   time.  Each write fills more sectors than the buffer cache
+   holds while the file's index blocks are in use. */
+
+#include "tests/filesys/seq-test.h"
+#include "tests/main.h"
+
+static char buf[150000];
+
+static size_t
+return_block_size (void) 
+{
+  return 40000;
+}
+
+void
+test_main (void) 
+{
+  seq_test ("testme",
+            buf, sizeof buf, 0,
+            return_block_size, NULL);
+}
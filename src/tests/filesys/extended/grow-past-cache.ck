@@ -0,0 +1,17 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+use tests::random;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(grow-past-cache) begin
+(grow-past-cache) create "testme"
+(grow-past-cache) open "testme"
+(grow-past-cache) writing "testme"
+(grow-past-cache) close "testme"
+(grow-past-cache) open "testme" for verification
+(grow-past-cache) verified contents of "testme"
+(grow-past-cache) close "testme"
+(grow-past-cache) end
+EOF
+pass;
@@ -34,6 +34,7 @@
 #endif
 #ifdef FILESYS
 #include "devices/disk.h"
+#include "filesys/cache.h"
 #include "filesys/filesys.h"
 #include "filesys/fsutil.h"
 #endif
@@ -242,6 +243,23 @@ parse_options (char **argv)
 #ifdef FILESYS
       else if (!strcmp (name, "-f"))
         format_filesys = true;
+      else if (!strcmp (name, "-cache"))
+        {
+          /* At most a quarter of RAM, about half the kernel pool. */
+          size_t max = ram_pages / 4 * (PGSIZE / DISK_SECTOR_SIZE);
+          int size = value != NULL ? atoi (value) : 0;
+
+          if (size < CACHE_SIZE_MIN || (size_t) size > max)
+            PANIC ("cache size `%s' out of range (use %d to %zu sectors)",
+                   value != NULL ? value : "", CACHE_SIZE_MIN, max);
+          cache_size = size;
+        }
+      else if (!strcmp (name, "-cache-policy"))
+        {
+          if (value == NULL || !cache_set_policy (value))
+            PANIC ("unknown cache policy `%s' (use clock or 2q)",
+                   value != NULL ? value : "");
+        }
 #endif
       else if (!strcmp (name, "-rs"))
         random_init (atoi (value));
@@ -350,6 +368,10 @@ usage (void)
           "  -h                 Print this help message and power off.\n"
           "  -q                 Power off VM after actions or on panic.\n"
           "  -f                 Format file system disk during startup.\n"
+#ifdef FILESYS
+          "  -cache=SECTORS     Hold SECTORS sectors (at least 64) in the buffer cache.\n"
+          "  -cache-policy=NAME Replace cache sectors by NAME: clock or 2q.\n"
+#endif
           "  -rs=SEED           Set random number seed to SEED.\n"
           "  -mlfqs             Use multi-level feedback queue scheduler.\n"
 #ifdef USERPROG
@@ -392,6 +414,7 @@ print_stats (void)
   thread_print_stats ();
 #ifdef FILESYS
   disk_print_stats ();
+  cache_print_stats ();
 #endif
   console_print_stats ();
   kbd_print_stats ();
@@ -41,6 +41,25 @@ void cond_wait (struct condition *, struct lock *);
 void cond_signal (struct condition *, struct lock *);
 void cond_broadcast (struct condition *, struct lock *);
 
+/* Readers-writer lock. */
+struct rwlock 
+  {
+    struct lock lock;           /* Guards the members below. */
+    struct condition readers_ok;    /* Signaled when readers may enter. */
+    struct condition writer_ok;     /* Signaled when a writer may enter. */
+    unsigned readers;           /* Number of readers holding the lock. */
+    unsigned waiting_writers;   /* Number of writers waiting. */
+    struct thread *writer;      /* Writer holding the lock, if any. */
+  };
+
+void rwlock_init (struct rwlock *);
+void rwlock_acquire_read (struct rwlock *);
+void rwlock_release_read (struct rwlock *);
+void rwlock_acquire_write (struct rwlock *);
+bool rwlock_try_acquire_write (struct rwlock *);
+void rwlock_release_write (struct rwlock *);
+bool rwlock_held_for_write (const struct rwlock *);
+
 /* Optimization barrier.
 
    The compiler will not reorder operations across an
@@ -217,8 +217,9 @@ thread_create (const char *name, int priority,
   init_child (child, tid);
   child->TCB = t;
 
-  t->fd_num = 2;
-  list_init(&t->file_list);
+  t->fd_table = NULL;
+  t->fd_cap = 0;
+  t->fd_map = NULL;
   t->parent = thread_current();
   list_push_back(&thread_current()->child_list, &child->elem);
 
@@ -105,9 +105,11 @@ struct thread
     void *esp;
     void *fault_addr;
     //struct process *proc;    //process information block (parent, child..)
-    /* File Descriptor Table */
-    int fd_num;
-    struct list file_list;
+    /* File Descriptor Table, indexed by fd.  A set bit in fd_map
+       marks a descriptor in use; 0 and 1 are the console. */
+    struct file_elem **fd_table;
+    size_t fd_cap;
+    struct bitmap *fd_map;
 	
 	int mapid;
 	struct list mmap_list;
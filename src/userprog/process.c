@@ -285,17 +285,8 @@ process_exit (void)
 
   /* FREE FILE DESCRIPTORS */
   struct list_elem *e;
-  struct file_elem *fe;
   filesys_lock_acquire();
-  while(!list_empty(&thread_current()->file_list)) {
-      e = list_begin(&thread_current()->file_list);
-      fe = list_entry(e, struct file_elem, elem);
-      //close -> it freed!
-	  //
-	  file_close(fe->name);
-	  e = list_remove(e);
-	  free(fe);
-  }
+  fd_table_destroy();
   filesys_lock_release();
 
   struct mmap_elem *me;
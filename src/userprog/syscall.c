@@ -13,11 +13,17 @@
 #include "filesys/free-map.h"
 #include "filesys/inode.h"
 #include "filesys/filesys.h"
+#include "filesys/cache.h"
+#include <bitmap.h>
+#include "threads/malloc.h"
 
 #define ARG_MAX 3
 #define STACK_SIZE 262144
 
 static void syscall_handler (struct intr_frame *);
+static int fd_install (struct file_elem *);
+static int getdents (int fd, struct dirent *, unsigned cnt);
+static int cachestat (struct cache_stats *);
 
 struct lock filesys_lock;
 
@@ -296,6 +302,13 @@ syscall_handler (struct intr_frame *f)
 		f->eax = readdir((int) arg[0], (char *)arg[1]);
 		break;
 	}
+	case SYS_GETDENTS:
+	{
+		get_arg(f, arg, 3);
+		f->eax = getdents((int) arg[0], (struct dirent *) arg[1],
+		                  (unsigned) arg[2]);
+		break;
+	}
 	case SYS_ISDIR:
 	{
 		get_arg(f, arg, 1);
@@ -308,6 +321,12 @@ syscall_handler (struct intr_frame *f)
 		f->eax = inumber((int) arg[0]);
 		break;
 	}
+	case SYS_CACHESTAT:
+	{
+		get_arg(f, arg, 1);
+		f->eax = cachestat((struct cache_stats *) arg[0]);
+		break;
+	}
   }
   ptr_unpin(pg_round_down((void*)f->esp));
 }
@@ -323,69 +342,11 @@ syscall_handler (struct intr_frame *f)
 int create(const char *name, unsigned size) {
     if (!userbuf_valid(name, strlen(name)+1))
         exit(-1);
-    /*
-    if (strlen(name) > 14) {
-    return 0;
-    } */
-    //frame_pin((void*)name, strlen(name)+1);
-    //
-    struct dir *temp_dir;
-    if (name[0] == '/') {
-        temp_dir = dir_open_root();
-    } else {
-        temp_dir = dir_reopen(thread_current()->current_dir);
-        if (temp_dir->inode->removed == true)
-            return false;
-    } 
-
-    int count = 0;
-    char *save_ptr_1, *token_1;
-    int namelen = strlen(name)+1;
-    char *new_name = malloc(namelen);
-    char *new_name2 = malloc(namelen);
-    strlcpy(new_name, name, strlen(name)+1);
-    strlcpy(new_name2, name, strlen(name)+1);
-    
-    for (token_1 = strtok_r(new_name, "/", &save_ptr_1); token_1 != NULL;
-            token_1 = strtok_r(NULL, "/", &save_ptr_1)) {
-        if (strlen(token_1) > 13)
-            return false;
-        count++;
-        //printf("token : %s, count %d\n", token_1, count);
-    }
-    free(new_name);
-
-    int i = 0;
-    char *save_ptr_2, *token_2 , name_2[14];
-    for (token_2 = strtok_r(new_name2, "/", &save_ptr_2); token_2 != NULL; 
-            token_2 = strtok_r (NULL, "/", &save_ptr_2)) {
-        //printf("token : %s\n", token_2);
-        struct inode *temp_inode;
-        if (i<count-1) {
-            dir_lookup(temp_dir, token_2, &temp_inode);
-            if (strcmp(token_2, ".") == 0) {
-                temp_inode = inode_open(temp_dir->inode->sector);
-            } else if (strcmp(token_2, "..") == 0) {
-                temp_inode = inode_open(temp_dir->inode->data.parent);
-            }
-            if (!temp_inode) {
-                dir_close(temp_dir);
-                return false;
-            }
-            dir_close(temp_dir);
-            temp_dir = dir_open(temp_inode);
-            i++;
-        } else {
-            strlcpy(name_2, token_2, strlen(token_2)+1);
-            //printf("created file name is %s\n", name_2);
-        }
-    }
-    /*if (count <= 1) {
-        strlcpy(name_2, new_name2, strlen(name)+1);
-    }*/
-    free(new_name2);
 
-    //printf("create file in directory %d\n", temp_dir->inode->sector);
+    struct dir *temp_dir;
+    char name_2[NAME_MAX + 1];
+    if (!filesys_walk(name, &temp_dir, name_2, NULL))
+        return false;
 
     //lock_acquire(&filesys_lock);
     int ret = filesys_create(name_2, size, temp_dir);
@@ -400,70 +361,20 @@ int remove(const char *file) {
     if (!userptr_valid(file))
         exit(-1);
 
-	if (strcmp(file,"/") == 0) {
-		return false;
-	}
-
 	struct dir *temp_dir;
+	struct inode *temp_inode;
+	char name[NAME_MAX + 1];
+	if (!filesys_walk(file, &temp_dir, name, &temp_inode))
+		return false;
 
-	if (file[0] == '/') {
-		temp_dir = dir_open_root();
-	} else {
-		temp_dir = dir_reopen(thread_current()->current_dir);	
-	}
-	
-	int count = 0;
-	char *save_ptr_1, *token_1;
-	char *file_cpy = malloc(strlen(file)+1);
-	strlcpy(file_cpy, file, strlen(file)+1);
-	for (token_1 = strtok_r(file_cpy, "/", &save_ptr_1); token_1 != NULL;
-			token_1 = strtok_r(NULL, "/", &save_ptr_1)) {
-		count++;
-	}
-
-	int i = 0;
-	char *save_ptr_2, *token_2 , name[14];
-	for (token_2 = strtok_r(file, "/", &save_ptr_2); token_2 != NULL; 
-				token_2 = strtok_r (NULL, "/", &save_ptr_2)) {
-		struct inode *temp_inode;
-        if (i<count-1) {
-            dir_lookup(temp_dir, token_2, &temp_inode);
-            if (strcmp(token_2, ".") == 0) {
-                temp_inode = inode_open(temp_dir->inode->sector);
-            } else if (strcmp(token_2, "..") == 0) {
-                temp_inode = inode_open(temp_dir->inode->data.parent);
-            }
-
-            if (!temp_inode) {
-                //printf("directory lookup failed\n");
-				return false;
-			}
-			dir_close(temp_dir);
-			temp_dir = dir_open(temp_inode);
-			i++;
-		} else {
-			strlcpy(name, token_2, strlen(token_2)+1);
-		}
-	}
-
-
-    //printf("name : %s\n", name);
-
-    //printf("remove directory's parent %d\n", temp_dir->inode->sector);
-    struct inode *temp_inode;
-    dir_lookup(temp_dir, name, &temp_inode);
-    /*if (strcmp(name, ".") == 0) {
-        temp_inode = inode_open(temp_dir->inode->sector);
-    } else if (strcmp(name, "..") == 0) {
-        temp_inode = inode_open(temp_dir->inode->data.parent);
-    }*/
-
-	if (!temp_inode) {
+	/* "/" and paths ending in "." or ".." name no entry. */
+	if (!temp_inode || name[0] == '\0') {
         //printf("lookup failed\n"); 
+		inode_close(temp_inode);
+		dir_close(temp_dir);
 		return false;
 	}
 
-
     //printf("remove directory is %d\n", temp_inode->sector);
 
     int ret;
@@ -477,17 +388,14 @@ int remove(const char *file) {
     } else {
         /* remove directory */
         //1. Check whether it is empty
-        struct dir_entry e;
-        int pos = 0;
-        while (inode_read_at(temp_inode, &e, sizeof e, pos) == sizeof e) {
-            pos += sizeof e;
-            //printf("entry name : %s\n", e.name);
-            if (e.in_use)
-            {
-                dir_close(temp_dir);
-                inode_close(temp_inode);
-                return false;
-            }
+        struct dir *d = dir_open(inode_reopen(temp_inode));
+        bool empty = d != NULL && dir_is_empty(d);
+        dir_close(d);
+        if (!empty)
+        {
+            dir_close(temp_dir);
+            inode_close(temp_inode);
+            return false;
         }
 
         //1-2. Check whether it is parent
@@ -511,110 +419,20 @@ int open(const char *name) {
     }
 
 	struct dir *temp_dir;
-	if (name[0] == '/') {
-		temp_dir = dir_open_root();
-	} else {
-		temp_dir = dir_reopen(thread_current()->current_dir);	
-	}
-
-
-	if (strcmp(name,"/") == 0) {
-		struct list *file_list = &thread_current()->file_list;
-		struct file_elem *fe = malloc(sizeof(struct file_elem));
-
-		if (!fe) {
-			dir_close(temp_dir);
-			frame_unpin((void*)name, strlen(name)+1);
-			return -1;
-		}
-
-		fe->dir_name = temp_dir;
-		fe->name = NULL;
-		int fd = fe->fd = thread_current()->fd_num++;
-		//printf("fd : %d\n", fd);
-		//strlcpy(fe->filename, name_2, strlen(name_2)+1);
-		list_push_back(file_list, &fe->elem);
-		frame_unpin((void*)name, strlen(name)+1);
-
-		return fd;
-	}
-
-	int count = 0;
-	char *save_ptr_1, *token_1;
-	char *name_cpy = malloc(strlen(name)+1);
-	strlcpy(name_cpy, name, strlen(name)+1);
-	for (token_1 = strtok_r(name_cpy, "/", &save_ptr_1); token_1 != NULL;
-			token_1 = strtok_r(NULL, "/", &save_ptr_1)) {
-		count++;
-	}
-
-	//printf("count : %d\n",count);
-
-	int i = 0;
-	char *save_ptr_2, *token_2;
-	char name_2[14];
-	char *name_cpy_2 = malloc(strlen(name)+1);
-	strlcpy(name_cpy_2, name, strlen(name)+1);
-	//printf("name : %s\n", name);
-    //printf("parse : %s\n", name_cpy_2);
-	for (token_2 = strtok_r(name_cpy_2, "/", &save_ptr_2); token_2 != NULL; 
-			token_2 = strtok_r (NULL, "/", &save_ptr_2)) {
-        //printf("token : %s\n", token_2);
-		struct inode *temp_inode;
-		if (i<count-1) {
-            //printf("lookup\n");
-            dir_lookup(temp_dir, token_2, &temp_inode);
-            //printf("lookup finish\n");
-            if (strcmp(token_2, ".") == 0) {
-                temp_inode = inode_open(temp_dir->inode->sector);
-            } else if (strcmp(token_2, "..") == 0) {
-                temp_inode = inode_open(temp_dir->inode->data.parent);
-            }
-
-            dir_close(temp_dir);
-			if (!temp_inode) {
-				return -1;
-			}
-
-			temp_dir = dir_open(temp_inode);
-			i++;
-		} else {
-			/* name_2 : file name or directory name */
-			strlcpy(name_2,token_2,strlen(token_2)+1);
-			//printf("name_2 : %s\n", name_2);
-		}
-		//printf("token : %s\n", token_2);
-	}
-	//printf("token : %s\n", token_2);
-	//if (count <= 1) {
-	/* we just find file in current directory */
-	//	strlcpy(name_2, name, strlen(name)+1);
-	//}
-	//printf("name_2 : %s\n", name_2);
 	struct inode *temp_inode = NULL;
-	dir_lookup(temp_dir, name_2, &temp_inode);
-    if (strcmp(name_2, ".") == 0) {
-        temp_inode = inode_open(temp_dir->inode->sector);
-    } else if (strcmp(name_2, "..") == 0) {
-        temp_inode = inode_open(temp_dir->inode->data.parent);
-    }
-    /*
-    if(temp_inode != NULL)
-        printf("inode is on sector %d\n", temp_inode->sector);
-    else
-        printf("inode is NULL\n");
-        */
+	char name_2[NAME_MAX + 1];
+	if (!filesys_walk(name, &temp_dir, name_2, &temp_inode))
+		return -1;
 
-	if (!temp_inode || temp_inode->removed || temp_dir->inode->removed) {
+	if (!temp_inode || temp_inode->removed) {
 		//printf("temp_inode : NULL\n");
+		inode_close(temp_inode);
 		dir_close(temp_dir);
 		return -1;
 	}
     //printf("open finish\n");
 
 	dir_close(temp_dir);
-	
-	
 
 	int fd;
 	if (!temp_inode->data.is_dir) {
@@ -630,7 +448,6 @@ int open(const char *name) {
 			return -1;
 		}
 
-		struct list *file_list = &thread_current()->file_list;
 		struct file_elem *fe = malloc(sizeof(struct file_elem));
 
 		if (!fe) {
@@ -642,9 +459,12 @@ int open(const char *name) {
 		}
 		fe->dir_name = NULL;
 		fe->name = openfile;
-		fd = fe->fd = thread_current()->fd_num++;
 		strlcpy(fe->filename, name_2, strlen(name_2)+1);
-		list_push_back(file_list, &fe->elem);
+		fd = fd_install(fe);
+		if (fd == -1) {
+			file_close(openfile);
+			free(fe);
+		}
 		frame_unpin((void*)name, strlen(name)+1);
 		//printf("fd : %d\n", fd);
 		return fd;
@@ -661,7 +481,6 @@ int open(const char *name) {
 			return -1;
 		}
 
-		struct list *file_list = &thread_current()->file_list;
 		struct file_elem *fe = malloc(sizeof(struct file_elem));
 
 		if (!fe) {
@@ -672,69 +491,119 @@ int open(const char *name) {
 
 		fe->dir_name = temp_dir;
 		fe->name = NULL;
-		fd = fe->fd = thread_current()->fd_num++;
+		fd = fd_install(fe);
 		//printf("fd : %d\n", fd);
 		//strlcpy(fe->filename, name_2, strlen(name_2)+1);
-		list_push_back(file_list, &fe->elem);
+		if (fd == -1) {
+			dir_close(temp_dir);
+			free(fe);
+		}
 		frame_unpin((void*)name, strlen(name)+1);
 
 		return fd;
 	}
 }
 
-struct file *find_file_desc(int fd) {
-    struct list_elem *e;
-    struct file_elem *fe;
-    for (e = list_begin(&thread_current()->file_list); e != list_end(&thread_current()->file_list); e = list_next(e)) {
-        fe = list_entry(e, struct file_elem, elem);
-        if (fe->fd == fd) {
-            return fe->name;
+/* Smallest size of a process's descriptor table. */
+#define FD_TABLE_MIN 16
+
+/* Installs FE in the current process's descriptor table under the
+   lowest free descriptor, growing the table if it is full.
+   Returns the descriptor, or -1 if out of memory. */
+static int fd_install(struct file_elem *fe) {
+    struct thread *t = thread_current();
+    size_t fd = BITMAP_ERROR;
+
+    if (t->fd_map != NULL)
+        fd = bitmap_scan_and_flip(t->fd_map, 0, 1, false);
+    if (fd == BITMAP_ERROR) {
+        /* Double the table.  The bitmap cannot grow in place, so
+           copy it; that is amortized over the descriptors added. */
+        size_t cap = t->fd_cap ? t->fd_cap * 2 : FD_TABLE_MIN;
+        struct file_elem **table = realloc(t->fd_table, cap * sizeof *table);
+        struct bitmap *map = bitmap_create(cap);
+        size_t i;
+
+        if (table != NULL)
+            t->fd_table = table;
+        if (table == NULL || map == NULL) {
+            bitmap_destroy(map);
+            return -1;
         }
+        for (i = t->fd_cap; i < cap; i++)
+            table[i] = NULL;
+        if (t->fd_map != NULL) {
+            for (i = 0; i < t->fd_cap; i++)
+                bitmap_set(map, i, bitmap_test(t->fd_map, i));
+            bitmap_destroy(t->fd_map);
+        } else
+            bitmap_set_multiple(map, 0, 2, true);   /* Console. */
+        t->fd_map = map;
+        t->fd_cap = cap;
+        fd = bitmap_scan_and_flip(map, 0, 1, false);
     }
-    return NULL;
+    t->fd_table[fd] = fe;
+    fe->fd = fd;
+    return fd;
 }
 
-struct dir *find_dir_desc(int fd) {
-    struct list_elem *e;
-    struct file_elem *fe;
-    for (e = list_begin(&thread_current()->file_list); e != list_end(&thread_current()->file_list); e = list_next(e)) {
-        fe = list_entry(e, struct file_elem, elem);
-        if (fe->fd == fd) {
-            return fe->dir_name;
-        }
-    }
-    return NULL;
+/* Returns the entry for descriptor FD of the current process, or a
+   null pointer if FD is not open. */
+static struct file_elem *fd_lookup(int fd) {
+    struct thread *t = thread_current();
+
+    if (fd < 0 || (size_t) fd >= t->fd_cap)
+        return NULL;
+    return t->fd_table[fd];
 }
 
-void close(int fd) {
+/* Closes the file or directory in FE and frees it. */
+static void fd_close_elem(struct file_elem *fe) {
+    if (!fe->dir_name)
+        file_close(fe->name);
+    else
+        dir_close(fe->dir_name);
+    free(fe);
+}
 
-    struct list *file_list = &thread_current()->file_list;
-    struct list_elem *e;
-    struct file_elem *fe;
-    
+/* Closes every descriptor of the current process and frees its
+   descriptor table. */
+void fd_table_destroy(void) {
+    struct thread *t = thread_current();
+    size_t fd;
 
-    for (e = list_begin(file_list); e != list_end(file_list); e = list_next(e)) {
-        fe = list_entry(e, struct file_elem, elem);
-        if (fe->fd == fd) {
-			if (!fe->dir_name) {
-            	struct file *file_to_close = find_file_desc(fd);
-				//printf("fd : %d\n",fd);
-				//printf("filename : %s\n", fe->filename);
-            	//lock_acquire(&filesys_lock);
-            	file_close(file_to_close);
-            	//lock_release(&filesys_lock);
-			} else {
-				struct dir *dir_to_close = find_dir_desc(fd);
-				dir_close(dir_to_close);
-			}
-            e = list_next(e);
-            list_remove(list_prev(e));
-            free(fe);
-            e = list_prev(e);
-			break;
-        }
-    }
+    for (fd = 0; fd < t->fd_cap; fd++)
+        if (t->fd_table[fd] != NULL)
+            fd_close_elem(t->fd_table[fd]);
+    free(t->fd_table);
+    bitmap_destroy(t->fd_map);
+    t->fd_table = NULL;
+    t->fd_cap = 0;
+    t->fd_map = NULL;
+}
+
+struct file *find_file_desc(int fd) {
+    struct file_elem *fe = fd_lookup(fd);
+    return fe ? fe->name : NULL;
+}
 
+struct dir *find_dir_desc(int fd) {
+    struct file_elem *fe = fd_lookup(fd);
+    return fe ? fe->dir_name : NULL;
+}
+
+void close(int fd) {
+    struct file_elem *fe = fd_lookup(fd);
+
+    if (!fe)
+        return;
+    //printf("fd : %d\n",fd);
+    //printf("filename : %s\n", fe->filename);
+    //lock_acquire(&filesys_lock);
+    thread_current()->fd_table[fd] = NULL;
+    bitmap_reset(thread_current()->fd_map, fd);
+    fd_close_elem(fe);
+    //lock_release(&filesys_lock);
 }
 
 void exit(int status) {
@@ -768,16 +637,8 @@ int wait(int pid) {
 }
     
 char *find_file_name(int fd) {
-    struct list_elem *e;
-    struct file_elem *fe;
-    struct file *target;
-    for (e = list_begin(&thread_current()->file_list); e != list_end(&thread_current()->file_list); e = list_next(e)) {
-        fe = list_entry(e, struct file_elem, elem);
-        if (fe->fd == fd) {
-            return fe->filename;
-        }
-    }
-    return NULL;
+    struct file_elem *fe = fd_lookup(fd);
+    return fe ? fe->filename : NULL;
 }
 
 int write(int fd, const void *buffer, unsigned size)
@@ -1015,105 +876,41 @@ void munmap (int mapid) {
 
 int chdir(const char *dir) {
     struct dir *temp_dir;
+    struct inode *temp_inode;
+    char name[NAME_MAX + 1];
 
-    if (dir[0] == '/') {
-        temp_dir = dir_open_root();
-    } else {
-        temp_dir = dir_reopen(thread_current()->current_dir);	
-    } 
-
-    char *save_ptr, *token;
-    for (token = strtok_r(dir, "/", &save_ptr); token != NULL; 
-            token = strtok_r (NULL, "/", &save_ptr)) {
-        //printf("temp_dir %x, token : %s\n", temp_dir,token);
-        struct inode *temp_inode;
-        dir_lookup(temp_dir, token, &temp_inode);
-        if (strcmp(token, ".") == 0) {
-            temp_inode = inode_open(temp_dir->inode->sector);
-        } else if (strcmp(token, "..") == 0) {
-            temp_inode = inode_open(temp_dir->inode->data.parent);
-        }
-
-        if (!temp_inode) {
-            //printf("temp_inode is NULL\n");
-            dir_close(temp_dir);
-            return false;
-        }
-        dir_close(temp_dir);
-        temp_dir = dir_open(temp_inode);
+    if (!filesys_walk(dir, &temp_dir, name, &temp_inode))
+        return false;
+    dir_close(temp_dir);
+    if (!temp_inode || !temp_inode->data.is_dir) {
+        //printf("temp_inode is NULL\n");
+        inode_close(temp_inode);
+        return false;
     }
+    temp_dir = dir_open(temp_inode);
+    if (!temp_dir)
+        return false;
+
     dir_close(thread_current()->current_dir);
-    thread_current()->current_dir = dir_reopen(temp_dir);
+    thread_current()->current_dir = temp_dir;
     //printf("current dir is now %d\n", temp_dir->inode->sector);
-    dir_close(temp_dir);
 
     return true;
 }
 
 int mkdir (const char *dir) {
 	struct dir *temp_dir;
+	char name[NAME_MAX + 1];
 
-	if (dir[0] == '/') {
-		temp_dir = dir_open_root();
-	} else {
-		temp_dir = dir_reopen(thread_current()->current_dir);	
-	} 
-
-	//int j;
-	//for (j = 0; j<count; j++) {
-		
-		//printf("dir : %s\n", dir);
-	
-	int count = 0;
-	char *dir_cpy = malloc(strlen(dir)+1);
-	strlcpy(dir_cpy, dir, strlen(dir)+1);
-	char *save_ptr_1, *token_1;
-	for (token_1 = strtok_r(dir_cpy, "/", &save_ptr_1); token_1 != NULL;
-			token_1 = strtok_r(NULL, "/", &save_ptr_1)) {
-		count++;
-	}
-
-	//printf("mkdir : %s\n", dir);
-
-	//printf("count : %d\n", count);
-    int i = 0;
-	char *save_ptr_2, *token_2 , name[14];
-	for (token_2 = strtok_r(dir, "/", &save_ptr_2); token_2 != NULL; 
-				token_2 = strtok_r (NULL, "/", &save_ptr_2)) {
-		struct inode *temp_inode;
-		if (i<count-1) {
-			dir_lookup(temp_dir, token_2, &temp_inode);
-            if (strcmp(token_2, ".") == 0) {
-                temp_inode = inode_open(temp_dir->inode->sector);
-            } else if (strcmp(token_2, "..") == 0) {
-                temp_inode = inode_open(temp_dir->inode->data.parent);
-            }
-
-			if (!temp_inode) {
-				//printf("1\n");
-				return false;
-			}
-			dir_close(temp_dir);
-			temp_dir = dir_open(temp_inode);
-			i++;
-		} else {
-			strlcpy(name, token_2, strlen(token_2)+1);
-            //printf("name is %s\n", name);
-		}
-	}
-    /*if (count <= 1) {
-        strlcpy(name, dir, strlen(dir)+1);
-		printf("name : %s\n", name);
-    }*/
-
-	//printf("name : %s\n",name);	
+	if (!filesys_walk(dir, &temp_dir, name, NULL))
+		return false;
 
 	disk_sector_t temp_inode_s = 0;
 
     int success = ( temp_dir != NULL 
             && free_map_allocate(1,&temp_inode_s)
             && dir_create(temp_inode_s, 16)
-            && dir_add(temp_dir, name, temp_inode_s) );
+            && dir_add(temp_dir, name, temp_inode_s, true) );
    // printf("parent : %d\n", temp_dir->inode->sector);
    // printf("created child : %d\n", temp_inode_s);
 
@@ -1122,15 +919,17 @@ int mkdir (const char *dir) {
     }
 
     /* add relative path to New directory */
-    struct inode *created_inode = inode_open(temp_inode_s);
-    created_inode->data.parent = temp_dir->inode->sector;
+    if (success) {
+        struct inode *created_inode = inode_open(temp_inode_s);
+        created_inode->data.parent = temp_dir->inode->sector;
 
-    struct inode_disk *disk_inode = malloc(sizeof (struct inode_disk));
+        struct inode_disk *disk_inode = malloc(sizeof (struct inode_disk));
 
-    inode_data_to_disk(disk_inode, &created_inode->data);
-    disk_write(filesys_disk, temp_inode_s, disk_inode);
-    inode_close(created_inode);
-    free(disk_inode);
+        inode_data_to_disk(disk_inode, &created_inode->data);
+        write_to_cache(temp_inode_s, 0, disk_inode, DISK_SECTOR_SIZE, false);
+        inode_close(created_inode);
+        free(disk_inode);
+    }
 
     //dir_add_relative(created_dir, ".", temp_inode_s);
     //dir_add_relative(created_dir, "..", temp_dir->inode->sector);
@@ -1151,6 +950,18 @@ int readdir (int fd, char *name) {
     return ret;
 }
 
+static int getdents (int fd, struct dirent *entries, unsigned cnt) {
+    if ((void *) entries >= PHYS_BASE
+        || cnt > ((uint8_t *) PHYS_BASE - (uint8_t *) entries) / sizeof *entries
+        || !userbuf_valid_no_code((char *) entries, cnt * sizeof *entries))
+        exit(-1);
+
+    struct dir *dir_to_read = find_dir_desc(fd);
+    int ret = dir_to_read ? (int) dir_read_entries (dir_to_read, entries, cnt) : -1;
+    frame_unpin(entries, cnt * sizeof *entries);
+    return ret;
+}
+
 int isdir(int fd) {
 	struct dir *dir= find_dir_desc(fd);
 	if (!dir) {
@@ -1167,3 +978,11 @@ int inumber (int fd) {
 	}
 	return dir->inode->sector;
 }
+
+static int cachestat (struct cache_stats *stats) {
+    if (!userbuf_valid_no_code((char *) stats, sizeof *stats))
+        exit(-1);
+    cache_get_stats(stats);
+    frame_unpin(stats, sizeof *stats);
+    return true;
+}
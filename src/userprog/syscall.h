@@ -8,7 +8,6 @@ struct file_elem {
     struct dir *dir_name;
 	int fd;
     char filename[15];
-    struct list_elem elem;
 	struct lock *file_lock;
 };
 
@@ -31,6 +30,7 @@ struct child_elem {
 
 
 void syscall_init (void);
+void fd_table_destroy (void);
 
 void filesys_lock_acquire (void);
 void filesys_lock_release (void);
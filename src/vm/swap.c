@@ -22,7 +22,7 @@ void swap_init(void) {
 /* MEMORY -> DISK */
 size_t swap_out (void *frame) {
 	lock_acquire(&swap_lock);
-	size_t free_slot = bitmap_scan_and_flip(swap_table, 0, 1, SWAP_FREE);
+	size_t free_slot = bitmap_scan_and_flip_next(swap_table, 1, SWAP_FREE);
 	//ASSERT (free_slot != BITMAP_ERROR);
 
     size_t i;